@@ -3,6 +3,7 @@
 #include <sys/types.h>
 #include <sys/dir.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <unistd.h>
@@ -10,12 +11,22 @@
 #include <math.h>
 #include <errno.h>
 #include <strings.h>
+#include <time.h>
+#include "photometry.h"
+#include "catalog.h"
+#include "ensemble.h"
+#include "lightcurve.h"
+#include "fitshdr.h"
 
 #define BUFSIZE 2056
-#define MINRADIUS 2
-#define MAXSTARS 15
 
-#define C 24
+// Processing stages timed when acn-aphot is run with -t
+enum stage { STAGE_CONFIG, STAGE_MASTER, STAGE_CHECK, STAGE_OPEN, STAGE_READ,
+    STAGE_CENTROID, STAGE_SKY, STAGE_APERTURE, STAGE_OUTPUT, NSTAGES
+};
+const char *stagenames[NSTAGES] = { "config", "master", "check", "open",
+    "read", "centroid", "sky", "aperture", "output"
+};
 
 /**
 *
@@ -24,29 +35,55 @@
 * 
 * 
 **/
-static FILE *open_result_file(const char *prefix);
-int centroid(double *x, double *y, double *subrectarray, double *mfarray,
-	     double *mbarray, int xpos, int ypos, int boxdims,
-	     int threshold);
-int calc_magnitude(double centx, double centy, double *subrectarray,
-		   double *mfarray, double *mbarray, int xpos, int ypos,
-		   int boxdims, double radius, double skyB);
-int compare_doubles(const void *X, const void *Y);
-int skybackground(double centx, double centy, double *subrectarray,
-		  double *mfarray, double *mbarray, int xpos, int ypos,
-		  int boxdims, double annulusval, double dannulusval,
-		  double radius, double *median);
-double euclidian_dist(int pixelxpos, int pixelypos, double centx,
-		      double centy);
+static FILE *open_result_file(const char *prefix, const char *suffix);
 extern int alphasort();
-double xguessarray[MAXSTARS], yguessarray[MAXSTARS], radiusarray[MAXSTARS],
-    annulusarray[MAXSTARS], dannulusarray[MAXSTARS], boxarray[MAXSTARS],
-    thresholdarray[MAXSTARS];
+double timer_now(void);
+void stage_stop(int stage, double start);
+void write_json_string(FILE * tfp, const char *s);
+void write_timing(FILE * tfp, const char *filename);
+void read_master_box(fitsfile * mffptr, fitsfile * mbfptr, double boxx,
+		     double boxy, double boxwidth, double *mf, double *mb);
+void star_start(int j, FILE * out);
+void star_box(int j, long *fpixel, long *lpixel);
+void star_plane(int j, long plane, double *apix, FILE * out, long *anaxes,
+		const char *filename);
+void process_by_plane(fitsfile * datafptr, long *anaxes,
+		      const char *filename);
+double file_jd(fitsfile * datafptr, const char *filename);
+void check_inputs(const char *dir, struct direct **files, int count,
+		  const long *naxes);
+void flush_lightcurve(int j);
+struct catalog stars;		// the stars from the config file or star table
+fitsfile *mffptr, *mbfptr;	// master flat and bias, open in cleanmode
+double **bpix;			// An Array of pointers for flats (NULL unless cleaning)
+double **cpix;			// An Array of pointers for bias
+
+// Per star state carried from plane to plane within a data file
+double *boxxarray, *boxyarray;	// centre of the box read for the star
+double *centxarray, *centyarray;	// centroid found on the last plane
+int *foundarray, *driftedarray;
 int debug = 0;
-char buf[BUFSIZE], *p, *token[7];
-int cleanmode = 0, i = 0, sc = 0;
+int cleanmode = 0, i = 0;
+int centroidmethod = CENTROID_THRESHOLD;	// selected with -m
+int tracking = 0;		// -k: follow each star from plane to plane
+double maxdrift = 0;		// flag stars further than this from the config position
+int planemode = 0;		// -p: read each plane once in strips of striprows
+long striprows = 0;
+int differential = 0;		// -e: differential photometry of an ensemble
+struct ensemble ens;
+char *lightcurvedir = NULL;	// -l: append to per star light curves, no .result
+struct lightcurve *curves;	// each star's records for the current file
+double filejd;			// Julian date of the current file
 FILE *fp = NULL;		// This is used within multiple functions
 
+// Stage timing. filetime/filecalls are reset for each data file and added to
+// runtime/runcalls once the per file line has been written.
+int timing = 0;
+double filetime[NSTAGES], runtime[NSTAGES];
+long filecalls[NSTAGES], runcalls[NSTAGES];
+long fileplanes = 0, filestars = 0, fileapertures = 0;
+long runfiles = 0, runplanes = 0, runstars = 0, runapertures = 0;
+
 /*
 *      acn-aphot: Estimate of point sources magnitude values using either a cleaned data file, or raw 
 *                 file which can be cleaned during the process. 
@@ -78,18 +115,52 @@ void bail(const char *msg, ...)
 void usage(void)
 {
     fprintf(stderr,
-	    "Usage: acn-aphot ./directory [-c ./masterflat ./masterbias] < ./config \n");
+	    "Usage: acn-aphot ./directory [-c ./masterflat ./masterbias] [-s ./starlist] [-m method] [-k pixels] [-p rows] [-e target:comp,..] [-l ./lightcurves] [-t ./timing.json] < ./config \n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Examples: \n");
     fprintf(stderr, "  acn-aphot ./objectfiledir < ./config\n");
     fprintf(stderr,
-	    "  acn-aphot ./objectfiledir -c ./masterflat ./masterbias < ./config\n\n");
+	    "  acn-aphot ./objectfiledir -c ./masterflat ./masterbias < ./config\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -s ./stars.fits\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -m iterate < ./config\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -k 5 < ./config\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -p 0 -s ./stars.fits\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -e 1:2,3,4 < ./config\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -l ./lightcurves < ./config\n");
+    fprintf(stderr,
+	    "  acn-aphot ./objectfiledir -t ./timing.json < ./config\n\n");
+    fprintf(stderr,
+	    "  -s reads the stars from a config file or a FITS table with columns X Y RADIUS\n"
+	    "     ANNULUS DANNULUS BOX THRESHOLD instead of the config on stdin\n");
+    fprintf(stderr,
+	    "  -m selects the centroid method: threshold (default), moment, iterate or gauss\n");
+    fprintf(stderr,
+	    "  -k tracks each star through the cube, seeding each plane from the previous\n"
+	    "     centroid, and flags stars drifting more than pixels from the config position\n");
+    fprintf(stderr,
+	    "  -p reads each plane once, in strips of rows (0 for whole planes), and cuts every\n"
+	    "     star box from memory instead of reading each box; use it for many stars\n");
+    fprintf(stderr,
+	    "  -e writes file.diff with the differential magnitude of the target star against\n"
+	    "     the weighted ensemble of comparison stars for each image and radius\n");
+    fprintf(stderr,
+	    "  -l appends the results to one light curve table per star in the directory,\n"
+	    "     time stamped with the file's JD (or DATE), instead of writing file.result;\n"
+	    "     read them with lctool\n");
+    fprintf(stderr,
+	    "  -t appends one JSON line of stage timings per file and a run summary\n\n");
 
 }
 
 int main(int argc, char *argv[])
 {
-    fitsfile *datafptr, *mffptr, *mbfptr;	/* FITS file pointers */
+    fitsfile *datafptr;         /* FITS file pointers */
     //char    buf[BUFSIZE]; // *p;   
 
     int status = 0;		/* CFITSIO status value MUST be initialized to zero! */
@@ -101,9 +172,8 @@ int main(int argc, char *argv[])
     1, 1, 1}, cnaxes[3] = {
     1, 1, 1};
 
-    double *apix, radius = 0;
-    double *bpix[MAXSTARS];	// An Array of pointers for bias 
-    double *cpix[MAXSTARS];	// An Array of pointers for flats
+    double *apix;
+    char *starlist = NULL, *ensemblespec = NULL;
 
     int file_select();
 
@@ -111,79 +181,105 @@ int main(int argc, char *argv[])
     int count, i = 0, path_max = pathconf(".", _PC_NAME_MAX);
     struct direct **files;
     char fullfilename[path_max];	//to store path and filename
-    double By = 0, Bx = 0, skyb = 0;
+    FILE *tfp = NULL;	// stage timing output
+    char *masterflat = NULL, *masterbias = NULL;
+    double t0, runstart;
 
 
     //
     // Verify we have the correct number of parameters
     //
 
-    if (argc == 5) {		// Verify that we selected  cleanmode.
-	if (strcmp(argv[2], "-c") == 0)
+    if (argc < 2) {
+	usage();
+	bail("Invalid parameters\n");
+    }
+    for (ii = 2; ii < argc; ii++) {
+	if (strcmp(argv[ii], "-c") == 0 && ii + 2 < argc) {	// cleanmode selected
 	    cleanmode = 1;
-	else {
+	    masterflat = argv[++ii];
+	    masterbias = argv[++ii];
+	} else if (strcmp(argv[ii], "-m") == 0 && ii + 1 < argc) {	// centroid method
+	    centroidmethod = centroid_method(argv[++ii]);
+	    if (centroidmethod < 0) {
+		usage();
+		bail("Unknown centroid method %s\n", argv[ii]);
+	    }
+	} else if (strcmp(argv[ii], "-s") == 0 && ii + 1 < argc) {	// star list file
+	    starlist = argv[++ii];
+	} else if (strcmp(argv[ii], "-p") == 0 && ii + 1 < argc) {	// plane reads
+	    planemode = 1;
+	    striprows = atol(argv[++ii]);
+	} else if (strcmp(argv[ii], "-k") == 0 && ii + 1 < argc) {	// centroid tracking
+	    tracking = 1;
+	    maxdrift = atof(argv[++ii]);
+	} else if (strcmp(argv[ii], "-e") == 0 && ii + 1 < argc) {	// differential photometry
+	    differential = 1;
+	    ensemblespec = argv[++ii];
+	} else if (strcmp(argv[ii], "-l") == 0 && ii + 1 < argc) {	// light curve tables
+	    lightcurvedir = argv[++ii];
+	} else if (strcmp(argv[ii], "-t") == 0 && ii + 1 < argc) {	// Stage timing requested
+	    tfp = fopen(argv[++ii], "a");
+	    if (tfp == NULL)
+		bail("Unable to open timing file %s\n", argv[ii]);
+	    timing = 1;
+	} else {
 	    usage();
 	    bail("Invalid parameters\n");
 	}
-    } else if (argc != 2) {
-	usage();
-	bail("Invalid parameters\n");
     }
+    runstart = timer_now();
     //
     // Parse the configuration file
     //
-    while (fgets(buf, BUFSIZE, stdin) != NULL) {
-	if (buf[0] == '!') {
-	    ;			// We just ignore the comment lines
-	} else {
-	    errno = 0;
-	    xguessarray[sc] = atof(strtok(buf, " "));
-	    if (xguessarray[sc] == 0)
-		bail("invalid config file X value");
-	    yguessarray[sc] = atof(strtok(NULL, " "));
-	    if (yguessarray[sc] == 0)
-		bail("invalid config file Y value");
-	    radiusarray[sc] = atof(strtok(NULL, " "));
-	    if (radiusarray[sc] == 0)
-		bail("invalid config file Radius value");
-	    annulusarray[sc] = atof(strtok(NULL, " "));
-	    if (annulusarray[sc] == 0)
-		bail("invalid config file annulus value");
-	    dannulusarray[sc] = atof(strtok(NULL, " "));
-	    if (dannulusarray[sc] == 0)
-		bail("invalid config file dannulus value");
-	    boxarray[sc] = atof(strtok(NULL, " "));
-	    if (boxarray[sc] == 0)
-		bail("invalid config file boxarry value");
-	    thresholdarray[sc] = atof(strtok(NULL, " "));
-	    if (thresholdarray[sc] == 0)
-		bail("invalid config file threshold value");
-	    if (errno != 0)
-		bail("Invalid config file detected");
-	    sc++;		// Increase the star counter
-	    if (sc > MAXSTARS)
-		bail("too many stars to proces in the config file\n");
-	}
-    }
+    t0 = timer_now();
+    catalog_init(&stars);
+    if (starlist != NULL)
+	catalog_read(&stars, starlist);	// config file or FITS star table
+    else
+	catalog_read_text(&stars, stdin);
+
+    stage_stop(STAGE_CONFIG, t0);
 
-    if (sc < 1) {
+    if (stars.nstars < 1) {
 	usage();
 	bail("Config file did not contain star data points\n");
     } else {
-	printf("Found %d stars \n", sc);
+	printf("Found %ld stars \n", stars.nstars);
     }
+    if (differential)
+	ensemble_parse(&ens, ensemblespec, &stars);
+    if (lightcurvedir != NULL && mkdir(lightcurvedir, 0755) != 0
+	&& errno != EEXIST)
+	bail("Unable to create %s: %s\n", lightcurvedir, strerror(errno));
+    bpix = (double **) calloc(stars.nstars, sizeof(double *));
+    cpix = (double **) calloc(stars.nstars, sizeof(double *));
+    boxxarray = (double *) malloc(stars.nstars * sizeof(double));
+    boxyarray = (double *) malloc(stars.nstars * sizeof(double));
+    centxarray = (double *) malloc(stars.nstars * sizeof(double));
+    centyarray = (double *) malloc(stars.nstars * sizeof(double));
+    foundarray = (int *) malloc(stars.nstars * sizeof(int));
+    driftedarray = (int *) malloc(stars.nstars * sizeof(int));
+    curves =
+	(struct lightcurve *) calloc(stars.nstars,
+				     sizeof(struct lightcurve));
+    if (bpix == NULL || cpix == NULL || boxxarray == NULL
+	|| boxyarray == NULL || centxarray == NULL || centyarray == NULL
+	|| foundarray == NULL || driftedarray == NULL || curves == NULL)
+	bail("Memory allocation error\n");
 
     // If we are going to clean the image then we have to first check the dimensions of the supplied
     // Master Bias and Master Flat. 
+    t0 = timer_now();
     if (cleanmode == 1) {	// This means we have to read the master flat and bias 
 
-	fits_open_file(&mffptr, argv[3], READONLY, &status);	// open master flat file
+	fits_open_file(&mffptr, masterflat, READONLY, &status);	// open master flat file
 	if (status) {
 	    fits_report_error(stderr, status);	// print error message
 	    bail(NULL);
 	}
 
-	fits_open_file(&mbfptr, argv[4], READONLY, &status);	// open master bias file
+	fits_open_file(&mbfptr, masterbias, READONLY, &status);	// open master bias file
 	if (status) {
 	    fits_report_error(stderr, status);	// print error message
 	    bail(NULL);
@@ -196,7 +292,7 @@ int main(int argc, char *argv[])
 	    bail(NULL);
 	}
 	if (bnaxis > 2)
-	    bail("Error: Master Flat File %s in an images with > 2 dimensions and is not supported\n", argv[3]);
+	    bail("Error: Master Flat File %s in an images with > 2 dimensions and is not supported\n", masterflat);
 
 	// Verify that the Master Bias and Master Flat are the same dimensions
 	fits_get_img_dim(mbfptr, &cnaxis, &status);	// read dimensions of each file
@@ -207,21 +303,15 @@ int main(int argc, char *argv[])
 	    bail(NULL);
 	}
 	if (cnaxis > 2)
-	    bail("Error: Master Bias File %s in an images with > 2 dimensions and is not supported\n", argv[4]);
+	    bail("Error: Master Bias File %s in an images with > 2 dimensions and is not supported\n", masterbias);
 
 	// Bias and Master files should be the same size.
 	if ((bnaxes[0] != cnaxes[0] || bnaxes[1] != cnaxes[1]))
 	    bail("Error: input images don't have same size\n");
 
 	// Read the master bias and the master flat files extracting the required values for each star
-	for (i = 0; i < sc; ++i) {
-	    fpixel[0] = xguessarray[i] - boxarray[i] / 2;	// set up coordinates for a subrect which is 
-	    fpixel[1] = yguessarray[i] - boxarray[i] / 2;	// 50 x50 width and height around the selected x/y coordinate provided
-	    lpixel[0] = xguessarray[i] + boxarray[i] / 2 - 1;	// need to put in code to verify they box size is OK
-	    lpixel[1] = yguessarray[i] + boxarray[i] / 2 - 1;
-	    inc[0] = inc[1] = 1;	// read all data pixels, don't skip any
-
-	    ndpixels = boxarray[i] * boxarray[i];	// 50 rows and 50 columns this is the number of pixels to store.
+	for (i = 0; i < stars.nstars; ++i) {
+	    ndpixels = stars.box[i] * stars.box[i];	// 50 rows and 50 columns this is the number of pixels to store.
 	    bpix[i] = (double *) malloc(ndpixels * sizeof(double));	// mem for rectangle dataset
 	    cpix[i] = (double *) malloc(ndpixels * sizeof(double));	// mem for rectangle dataset
 
@@ -231,26 +321,21 @@ int main(int argc, char *argv[])
 	    bzero((void *) bpix[i], ndpixels * sizeof(double));
 	    bzero((void *) cpix[i], ndpixels * sizeof(double));
 
-	    // Get the MF subrect value
-	    if (fits_read_subset
-		(mffptr, TDOUBLE, fpixel, lpixel, inc, NULL, bpix[i], NULL,
-		 &status)) {
-		fits_report_error(stderr, status);	// print error message
-		bail("Failed to read subset Master Flat of the image \n");
-	    }
-	    // Get the MB subrect value
-	    if (fits_read_subset
-		(mbfptr, TDOUBLE, fpixel, lpixel, inc, NULL, cpix[i], NULL,
-		 &status)) {
-		fits_report_error(stderr, status);	// print error message
-		bail("Failed to read subset Master Bias of the image \n");
-	    }
-
+	    read_master_box(mffptr, mbfptr, stars.x[i], stars.y[i],
+			    stars.box[i], bpix[i], cpix[i]);
 	}
     }
+    stage_stop(STAGE_MASTER, t0);
 
     count = scandir(argv[1], &files, file_select, alphasort);
     printf("Processing %d files \n", count);
+
+    // Check every data file from its header before processing any of them, in
+    // parallel, so a bad or truncated file stops the run before the others are
+    // processed. When cleaning they must also be the size of the masters.
+    t0 = timer_now();
+    check_inputs(argv[1], files, count, cleanmode == 1 ? bnaxes : NULL);
+    stage_stop(STAGE_CHECK, t0);
     //
     // Process each of the data files, Remembering that the data files may be Cubed files
     //
@@ -261,6 +346,7 @@ int main(int argc, char *argv[])
 		 files[i]->d_name);
 
 	printf("Processing File...%s\n", files[i]->d_name);
+	t0 = timer_now();
 	fits_open_file(&datafptr, fullfilename, READONLY, &status);	// open input images
 	if (status) {
 	    fits_report_error(stderr, status);	// print error message
@@ -283,70 +369,78 @@ int main(int argc, char *argv[])
 		bail("Error: input images don't have same size\n");
 	}
 
-	fp = open_result_file(files[i]->d_name);
+	stage_stop(STAGE_OPEN, t0);
+
+	t0 = timer_now();
+	if (lightcurvedir != NULL) {
+	    filejd = file_jd(datafptr, files[i]->d_name);
+	    fp = fopen("/dev/null", "w");	// the star headers and warnings
+	} else
+	    fp = open_result_file(files[i]->d_name, ".result");
+	if (fp == NULL)
+	    bail("Unable to write the results of %s\n", files[i]->d_name);
+	stage_stop(STAGE_OUTPUT, t0);
+	if (differential)
+	    ensemble_start(&ens, anaxes[2]);
+	fileplanes = anaxes[2];
+	filestars = stars.nstars;
 
 	// Loop through each of the stars found in the configuraiton file
 	// They may contain different box sizes, x,y guesses, radius ranges and thresholds
 	//
 	// The looping means that for a particular star we see the data results for that star across each of the
 	// images in the cube, we then go on the next start which we read through the cube. 
-	// Need to check how we want to group the output. 
-	for (j = 0; j < sc; j++) {
-
-	    fprintf(fp,
-		    "Processing star number %d in configuration file\n\n",
-		    j + 1);
-	    ndpixels = boxarray[j] * boxarray[j];	// 50 rows and 50 columns this is the number of pixels to store.
-	    apix = (double *) malloc(ndpixels * sizeof(double));	// mem for rectangle dataset
-
-	    if (apix == NULL) {
-		bail("Memory allocation error\n");
-	    }
-	    bzero((void *) apix, ndpixels * sizeof(apix[0]));
-
-	    fpixel[0] = xguessarray[j] - boxarray[j] / 2;	// set up coordinates for a subrect which is 
-	    fpixel[1] = yguessarray[j] - boxarray[j] / 2;	// 50 x50 width and height around the selected x/y coordinate provided
-	    lpixel[0] = xguessarray[j] + boxarray[j] / 2 - 1;	// need to put in code to verify they box size is OK
-	    lpixel[1] = yguessarray[j] + boxarray[j] / 2 - 1;
-	    inc[0] = inc[1] = 1;	// read all data pixels, don't skip any
-
-	    if (fpixel[0] < 1 || fpixel[1] < 1 || lpixel[0] < 1
-		|| lpixel[1] < 1)
-		bail("Not able to get a box area around the x,y coordinate %d %d %d %d\n", fpixel[0], fpixel[1], lpixel[0], lpixel[1]);
-
-	    // This code will loop through each of the images in the data Cube and process the current subrect identified
-	    for (fpixel[2] = 1; fpixel[2] <= anaxes[2]; fpixel[2]++) {
-
-		fprintf(fp, "Working on Image %ld \n", fpixel[2]);
-
-		if (fits_read_subset
-		    (datafptr, TDOUBLE, fpixel, lpixel, inc, NULL, apix,
-		     NULL, &status)) {
-		    fits_report_error(stderr, status);	// print error message
-		    bail("Failed to read subset of the image \n");
+	// With -p the cube is read a plane at a time instead and the results are
+	// gathered per star so the output is grouped the same way.
+	if (planemode) {
+	    process_by_plane(datafptr, anaxes, files[i]->d_name);
+	    for (j = 0; j < stars.nstars; j++)
+		flush_lightcurve(j);
+	} else
+	    for (j = 0; j < stars.nstars; j++) {
+		star_start(j, fp);
+		ndpixels = stars.box[j] * stars.box[j]; // 50 rows and 50 columns this is the number of pixels to store.
+		apix = (double *) malloc(ndpixels * sizeof(double));	// mem for rectangle dataset
+
+		if (apix == NULL) {
+		    bail("Memory allocation error\n");
 		}
-		fprintf(fp,
-			"Radius     X        Y          S       I       SkyB       Mag Estimate \n");
-
-		centroid(&Bx, &By, apix, bpix[j], cpix[j], xguessarray[j],
-			 yguessarray[j], boxarray[j], thresholdarray[j]);
-
-		//Generate software aperature of varying sizes
-		for (radius = MINRADIUS; radius < radiusarray[0]; radius++) {
-		    skybackground(Bx, By, apix, bpix[j], cpix[j],
-				  xguessarray[j], yguessarray[j],
-				  boxarray[j], annulusarray[j],
-				  dannulusarray[j], radius, &skyb);
-		    // Sky background changes as radius moves and pushes out the annulus
-		    calc_magnitude(Bx, By, apix, bpix[j], cpix[j],
-				   xguessarray[j], yguessarray[j],
-				   boxarray[j], radius, skyb);
+		bzero((void *) apix, ndpixels * sizeof(apix[0]));
+
+		// This code will loop through each of the images in the data Cube and process the current subrect identified
+		for (fpixel[2] = 1; fpixel[2] <= anaxes[2]; fpixel[2]++) {
+		    star_box(j, fpixel, lpixel);
+		    inc[0] = inc[1] = 1;	// read all data pixels, don't skip any
+
+		    t0 = timer_now();
+		    if (fits_read_subset
+			(datafptr, TDOUBLE, fpixel, lpixel, inc, NULL, apix,
+			 NULL, &status)) {
+			fits_report_error(stderr, status);	// print error message
+			bail("Failed to read subset of the image \n");
+		    }
+		    stage_stop(STAGE_READ, t0);
+
+		    star_plane(j, fpixel[2], apix, fp, anaxes,
+			       files[i]->d_name);
 		}
+		free(apix);
+		flush_lightcurve(j);
 	    }
-	    free(apix);
-	}
 
+	t0 = timer_now();
 	fclose(fp);
+	if (differential) {
+	    fp = open_result_file(files[i]->d_name, ".diff");
+	    if (fp == NULL)
+		bail("Unable to write %s.diff\n", files[i]->d_name);
+	    ensemble_write(&ens, fp);
+	    fclose(fp);
+	}
+	stage_stop(STAGE_OUTPUT, t0);
+
+	if (timing)
+	    write_timing(tfp, files[i]->d_name);
 
 	// Close the input data file
 	fits_close_file(datafptr, &status);
@@ -356,7 +450,7 @@ int main(int argc, char *argv[])
 	}
     }
     if (cleanmode == 1) {
-	for (i = 0; i < sc; i++) {
+	for (i = 0; i < stars.nstars; i++) {
 	    free(bpix[i]);
 	    free(cpix[i]);
 	}
@@ -368,6 +462,27 @@ int main(int argc, char *argv[])
 	    bail(NULL);
 	}
     }
+    free(bpix);
+    free(cpix);
+    free(boxxarray);
+    free(boxyarray);
+    free(centxarray);
+    free(centyarray);
+    free(foundarray);
+    free(driftedarray);
+    for (j = 0; j < stars.nstars; j++)
+	free(curves[j].rec);
+    free(curves);
+    if (differential)
+	ensemble_free(&ens);
+    catalog_free(&stars);
+    aperture_free();
+    if (timing) {
+	write_timing(tfp, NULL);
+	fprintf(tfp, "{\"summary\":\"run\",\"elapsed\":%.6f}\n",
+		timer_now() - runstart);
+	fclose(tfp);
+    }
     for (i = 0; i < count; i++) {
 	free(files[i]);
     }
@@ -375,9 +490,8 @@ int main(int argc, char *argv[])
     exit(0);
 }
 
-static FILE *open_result_file(const char *prefix)
+static FILE *open_result_file(const char *prefix, const char *suffix)
 {
-    const char *suffix = ".result";
     char *filename = strdup(prefix);
     filename = realloc(filename, strlen(prefix) + strlen(suffix) + 1);
     strcat(filename, suffix);
@@ -387,249 +501,475 @@ static FILE *open_result_file(const char *prefix)
 }
 
 
-/*
-    skybackground: This function will create an annulus and a dannulus around the centre of the object
-                   and calculate the skybackground by finding the MEDIAN value all all pixels found (exludes
-                   partial pixels)
- */
-int
-skybackground(double centx, double centy, double *subrectarray,
-	      double *mfarray, double *mbarray, int xpos, int ypos,
-	      int boxdims, double annulusval, double dannulusval,
-	      double radius, double *median)
-{
-
-    float By = 0;
-    float Bx = 0;
-    float dist = 0;
-    int pixelmaskcounter = 0;
-    int ii, b, pixelxpos = 0, pixelypos = 0, mask = 0;
-    int rowcounter, colcounter, Npix = 0;
-    float readval = 0, annulus = 0, dannulus = 0;
-    double *epix, I = 0, S = 0, skyB = 50, Magnitude;
-    double *dpix, medianval = 0;
-
-    annulus = radius + annulusval;
-    dannulus = annulus + dannulusval;
-
-    if (dannulus > boxdims / 2) {
-	printf
-	    ("radius = %f, annulus = %f, dannunlus = %f, boxdims/2 = %d \n",
-	     radius, annulus, dannulus, boxdims / 2);
-	bail("Need larger box around centre point to compute dannulus\n");
-    }
-    epix = (double *) malloc(boxdims * boxdims * sizeof(double));	// mem for Mask
-    dpix = (double *) malloc(boxdims * boxdims * sizeof(double));	// max amount of pixels requried
 
-    if (epix == NULL || dpix == NULL)
+//
+// Check the count data files in dir with fitshdr_check_images, bailing with
+// the first problem found. naxes, when not NULL, is the size they must be.
+//
+void check_inputs(const char *dir, struct direct **files, int count,
+		  const long *naxes)
+{
+    struct fits_image same;
+    char **paths, errmsg[BUFSIZE];
+    long bad;
+    int i;
+
+    if (count <= 0)
+	return;
+    paths = (char **) calloc(count, sizeof(char *));
+    if (paths == NULL)
 	bail("Memory allocation error\n");
+    for (i = 0; i < count; i++) {
+	snprintf(errmsg, sizeof(errmsg), "%s%s", dir, files[i]->d_name);
+	if ((paths[i] = strdup(errmsg)) == NULL)
+	    bail("Memory allocation error\n");
+    }
+    if (naxes != NULL) {
+	same.naxes[0] = naxes[0];
+	same.naxes[1] = naxes[1];
+    }
+    bad = fitshdr_check_images(paths, count, 3, naxes != NULL ? &same : NULL,
+			       NULL, errmsg, sizeof(errmsg));
+    if (bad > 0)
+	bail("Error: %ld of %d data files are not usable, the first: %s\n",
+	     bad, count, errmsg);
+    for (i = 0; i < count; i++)
+	free(paths[i]);
+    free(paths);
+}
 
-    for (ii = 0; ii < boxdims; ii++) {	// loop over the rows
-	rowcounter = 0;
-	for (b = 0; b < boxdims; b++) {	// loop over elements in the rows
 
+int file_select(struct direct *entry)
+{
 
-	    pixelxpos = b + xpos - boxdims / 2;	// Get the x point in the frame not just the subrect
-	    pixelypos = ii + ypos - boxdims / 2;	// Get the y point in the frame not just the subrect
+    char *ptr;
 
-	    dist = euclidian_dist(pixelxpos, pixelypos, centx, centy);	// Find dist to that pixel from the centre
+    if ((strcmp(entry->d_name, ".") == 0)
+	|| (strcmp(entry->d_name, "..") == 0))
+	return (FALSE);
 
-	    //
-	    // This section calculates the % of the pixel intensity to use.
-	    //
-	    if (dist < (dannulus - 0.5) && (dist > (annulus + 0.5))) {
-		if (cleanmode == 1)
-		    dpix[Npix++] = (subrectarray[ii * boxdims + b] - mbarray[ii * boxdims + b]) / mfarray[ii * boxdims + b];	// store the pixel value for sorting later
-		else
-		    dpix[Npix++] = subrectarray[ii * boxdims + b];	// store the pixel value for sorting later
-	    }
-	}
-    }
+    /* Check for filename extensions */
+    ptr = strrchr(entry->d_name, '.');
+    return ((ptr != NULL) && (strcmp(ptr, ".fits") == 0));
+}
 
-    qsort(dpix, Npix, sizeof(double), compare_doubles);	// Sort all of the values
 
-    // Find the median value
-    if (Npix % 2 == 0)
-	*median = (dpix[(Npix / 2) - 1] + dpix[(Npix / 2)]) / 2;	// Even
-    else
-	*median = (dpix[((Npix + 1) / 2) - 1]);	// Odd
-
-    free(epix);
-    free(dpix);
+//
+// Monotonic clock used for the stage timings. Returns 0 when timing is off so
+// an untimed run costs only a branch per stage.
+//
+double timer_now(void)
+{
+    struct timespec ts;
 
-    return 0;			// return value when all OK.
+    if (!timing)
+	return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-
-/*
- 
- */
-
-int
-calc_magnitude(double centx, double centy, double *subrectarray,
-	       double *mfarray, double *mbarray, int xpos, int ypos,
-	       int boxdims, double radius, double skyB)
+// Add the time since start to the current file's total for the stage
+void stage_stop(int stage, double start)
 {
+    if (!timing)
+	return;
+    filetime[stage] += timer_now() - start;
+    filecalls[stage]++;
+}
 
-    float By = 0;
-    float Bx = 0;
-    float dist = 0;
-    int pixelmaskcounter = 0;
-    int ii, b, pixelxpos = 0, pixelypos = 0, mask = 0;
-    int rowcounter, colcounter;
-    float readval = 0;
-    double *bpix, Npix = 0, I = 0, S = 0, Magnitude;
-
-    bpix = (double *) malloc(boxdims * boxdims * sizeof(double));	// mem for Mask
-    for (ii = 0; ii < boxdims; ii++) {	// loop over the rows
-	rowcounter = 0;
-	for (b = 0; b < boxdims; b++) {	// loop over elements in the rows
-	    // Generate the bitmask using a threshold value of 660
-	    pixelxpos = b + xpos - boxdims / 2;
-	    pixelypos = ii + ypos - boxdims / 2;
-	    dist = euclidian_dist(pixelxpos, pixelypos, centx, centy);
-	    //
-	    // This section calculates the % of the pixel intensity to use.
-	    //
-	    if (dist == radius)
-		mask = 0.5;	// On the aperature use 1/2 the pixel values
-	    else if (dist < (radius - 0.5))
-		mask = 1;	// inside the aperture use all the pixel values
-	    else if (dist > (radius + 0.5))
-		mask = 0;	// outside the aperture don't use pixel values
-	    else
-		mask = radius + 0.5 - dist;	// Calculate the partial pixel % further away is smaller
-
-	    Npix += mask;	// Keep track of the numebr of pixels in the aperture
+// Write s as the characters of a JSON string, escaping quotes, backslashes and
+// control characters
+void write_json_string(FILE * tfp, const char *s)
+{
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(tfp, "\\%c", *s);
+	else if ((unsigned char) *s < 0x20)
+	    fprintf(tfp, "\\u%04x", (unsigned char) *s);
+	else
+	    fputc(*s, tfp);
+    }
+}
 
-	    if (cleanmode == 1)
-		S += ((subrectarray[ii * boxdims + b] -
-		       mbarray[ii * boxdims + b]) / mfarray[ii * boxdims +
-							    b]) * mask;
-	    else
-		S += subrectarray[ii * boxdims + b] * mask;
+//
+// Write one JSON line with the stage timings. With a filename the per file
+// values are written and folded into the run totals, with NULL the run totals
+// are written. The config and master stages happen once per run so they only
+// appear in the run summary.
+//
+void write_timing(FILE * tfp, const char *filename)
+{
+    int s;
+
+    if (filename != NULL) {
+	fprintf(tfp, "{\"file\":\"");
+	write_json_string(tfp, filename);
+	fprintf(tfp, "\",\"planes\":%ld,\"stars\":%ld,\"apertures\":%ld",
+		fileplanes, filestars, fileapertures);
+	for (s = STAGE_OPEN; s < NSTAGES; s++)
+	    fprintf(tfp, ",\"%s\":%.6f,\"%s_calls\":%ld", stagenames[s],
+		    filetime[s], stagenames[s], filecalls[s]);
+	fprintf(tfp, "}\n");
+	runfiles++;
+	runplanes += fileplanes;
+	runstars += filestars * fileplanes;
+	runapertures += fileapertures;
+	fileapertures = 0;
+    } else {
+	fprintf(tfp,
+		"{\"summary\":\"stages\",\"files\":%ld,\"planes\":%ld,\"starplanes\":%ld,\"apertures\":%ld",
+		runfiles, runplanes, runstars, runapertures);
+	for (s = 0; s < NSTAGES; s++)
+	    fprintf(tfp, ",\"%s\":%.6f,\"%s_calls\":%ld", stagenames[s],
+		    runtime[s] + filetime[s], stagenames[s],
+		    runcalls[s] + filecalls[s]);
+	fprintf(tfp, "}\n");
+    }
+    fflush(tfp);
+
+    // Fold the per file values into the run totals. The config and master
+    // stages are only ever recorded in the run totals.
+    for (s = 0; s < NSTAGES; s++) {
+	if (filename != NULL || s < STAGE_OPEN) {
+	    runtime[s] += filetime[s];
+	    runcalls[s] += filecalls[s];
+	    filetime[s] = 0;
+	    filecalls[s] = 0;
 	}
     }
-    I = S - (skyB * Npix);
-    Magnitude = (-2.5 * log10(I)) + C;
-    fprintf(fp, "%7.0f %7.4f %7.4f %7.6f %7.6f %7.2f %7.5f \n", radius,
-	    centx, centy, S, I, skyB, Magnitude);
+}
 
-    free(bpix);
 
-    return 0;			// return value when all OK.
+//
+// Read the master flat and master bias subrects for the box of width boxwidth
+// centred on boxx, boxy into mf and mb
+//
+void read_master_box(fitsfile * mffptr, fitsfile * mbfptr, double boxx,
+		     double boxy, double boxwidth, double *mf, double *mb)
+{
+    long fpixel[2], lpixel[2], inc[2] = { 1, 1 };
+    int status = 0;
+
+    fpixel[0] = boxx - boxwidth / 2;
+    fpixel[1] = boxy - boxwidth / 2;
+    lpixel[0] = boxx + boxwidth / 2 - 1;
+    lpixel[1] = boxy + boxwidth / 2 - 1;
+
+    // Get the MF subrect value
+    if (fits_read_subset
+	(mffptr, TDOUBLE, fpixel, lpixel, inc, NULL, mf, NULL, &status)) {
+	fits_report_error(stderr, status);	// print error message
+	bail("Failed to read subset Master Flat of the image \n");
+    }
+    // Get the MB subrect value
+    if (fits_read_subset
+	(mbfptr, TDOUBLE, fpixel, lpixel, inc, NULL, mb, NULL, &status)) {
+	fits_report_error(stderr, status);	// print error message
+	bail("Failed to read subset Master Bias of the image \n");
+    }
 }
 
 
 //
-// Given an array of values representing a rectangular part of the image containing 
-// a point source find the X & Y centroid value
-// Need to pass in the following parameters 
-// 
-//  x,y - these are used to pass the centroid values back to the calling program
-//  subrect - This is the array returned from the fits_read_subset function containing values from a specific region
-//  xpos,ypos - this is the offset X,Y positions use to calculate where the real centroid value is. This was our initial guess
-//  boxdims - width & heigh of the box (assumed to be a square - this is very important!
-//  threshold - value used to determine what value is cutoff for use in the mask.
-//  
+// Start star j on a new data file. The box starts on the config position.
+// When tracking it follows the centroid from plane to plane and the centroid
+// search is restricted to a window around the previous plane's centroid.
 //
-//  Paul Doyle -  March 2012
+void star_start(int j, FILE * out)
+{
+    fprintf(out, "Processing star number %d in configuration file\n\n",
+	    j + 1);
+    boxxarray[j] = stars.x[j];
+    boxyarray[j] = stars.y[j];
+    foundarray[j] = driftedarray[j] = 0;
+    if (tracking && cleanmode == 1)	// the previous file may have moved it
+	read_master_box(mffptr, mbfptr, boxxarray[j], boxyarray[j],
+			stars.box[j], bpix[j], cpix[j]);
+}
 
-int
-centroid(double *x, double *y, double *subrectarray, double *mfarray,
-	 double *mbarray, int xpos, int ypos, int boxdims, int threshold)
+// First and last pixel of the box currently read for star j
+void star_box(int j, long *fpixel, long *lpixel)
 {
+    fpixel[0] = boxxarray[j] - stars.box[j] / 2;	// set up coordinates for a subrect which is 
+    fpixel[1] = boxyarray[j] - stars.box[j] / 2;	// 50 x50 width and height around the selected x/y coordinate provided
+    lpixel[0] = boxxarray[j] + stars.box[j] / 2 - 1;	// need to put in code to verify they box size is OK
+    lpixel[1] = boxyarray[j] + stars.box[j] / 2 - 1;
 
-    float By = 0;
-    float Bx = 0;
-    int pixelmaskcounter = 0;
-    int ii, b;
-    int rowcounter, colcounter;
-    float readval = 0;
-    double *bpix;
+    if (fpixel[0] < 1 || fpixel[1] < 1 || lpixel[0] < 1 || lpixel[1] < 1)
+	bail("Not able to get a box area around the x,y coordinate %d %d %d %d\n", fpixel[0], fpixel[1], lpixel[0], lpixel[1]);
+}
 
-    bpix = (double *) malloc(boxdims * boxdims * sizeof(double));	// mem for Mask
+//
+// Photometry of star j on one plane. apix holds the box read by star_box()
+// and the results are written to out.
+//
+void star_plane(int j, long plane, double *apix, FILE * out, long *anaxes,
+		const char *filename)
+{
+    double Bx = centxarray[j], By = centyarray[j], boxx = boxxarray[j],
+	boxy = boxyarray[j], radius, skyb = 0, S, I, Magnitude, t0;
+    long r;
+
+    fprintf(out, "Working on Image %ld \n", plane);
+    fprintf(out,
+	    "Radius     X        Y          S       I       SkyB       Mag Estimate \n");
+
+    t0 = timer_now();
+    if (!tracking || !foundarray[j]
+	|| track_centroid(centroidmethod, &Bx, &By, apix, bpix[j], cpix[j],
+			  boxx, boxy, stars.box[j], stars.threshold[j],
+			  stars.box[j] / 4) != 0)
+	foundarray[j] =
+	    find_centroid(centroidmethod, &Bx, &By, apix, bpix[j], cpix[j],
+			  boxx, boxy, stars.box[j], stars.threshold[j]) == 0;
+    stage_stop(STAGE_CENTROID, t0);
+    centxarray[j] = Bx;
+    centyarray[j] = By;
+
+    if (tracking && foundarray[j] && maxdrift > 0 && !driftedarray[j]
+	&& hypot(Bx - stars.x[j], By - stars.y[j]) > maxdrift) {
+	driftedarray[j] = 1;	// flag once per star and file
+	fprintf(out,
+		"Drift warning: star %d is %.2f pixels from its config position\n",
+		j + 1, hypot(Bx - stars.x[j], By - stars.y[j]));
+	printf
+	    ("Drift warning: %s star %d moved more than %.1f pixels by image %ld\n",
+	     filename, j + 1, maxdrift, plane);
+    }
 
-    for (ii = 0; ii < boxdims; ii++) {
-	rowcounter = 0;
-	for (b = 0; b < boxdims; b++) {
-	    // Generate the bitmask using a threshold value of 660
-	    if (cleanmode == 1)
-		readval =
-		    (subrectarray[ii * boxdims + b] -
-		     mbarray[ii * boxdims + b]) / mfarray[ii * boxdims +
-							  b];
-	    else
-		readval = subrectarray[ii * boxdims + b];
-
-	    if (readval > threshold) {
-		bpix[ii * boxdims + b] = 1;
-		pixelmaskcounter++;
-		rowcounter++;	// counter the number of events in the row
-	    } else
-		bpix[ii * boxdims + b] = 0;
+    //Generate software aperature of varying sizes
+    for (r = stars.radiusfirst[j];
+	 r < stars.radiusfirst[j] + stars.nradii[j]; r++) {
+	radius = stars.radii[r];
+	t0 = timer_now();
+	skybackground(Bx, By, apix, bpix[j], cpix[j], boxx, boxy,
+		      stars.box[j], stars.annulus[j], stars.dannulus[j],
+		      radius, &skyb);
+	stage_stop(STAGE_SKY, t0);
+	// Sky background changes as radius moves and pushes out the annulus
+	t0 = timer_now();
+	calc_magnitude(Bx, By, apix, bpix[j], cpix[j], boxx, boxy,
+		       stars.box[j], radius, skyb, &S, &I, &Magnitude);
+	stage_stop(STAGE_APERTURE, t0);
+	fileapertures++;
+	if (differential)
+	    ensemble_record(&ens, j, plane, radius, S, I, Magnitude);
+	if (lightcurvedir != NULL) {
+	    struct lc_record rec = { filejd, plane, radius, Bx, By, S, I,
+		skyb, Magnitude
+	    };
+	    lc_add(&curves[j], &rec);
 	}
-	By += rowcounter * ii;	// By count of pixel row elements
+
+	t0 = timer_now();
+	fprintf(out, "%7.4g %7.4f %7.4f %7.6f %7.6f %7.2f %7.5f \n",
+		radius, Bx, By, S, I, skyb, Magnitude);
+	stage_stop(STAGE_OUTPUT, t0);
     }
 
-    // Process the colums to get the X centre point
-    for (ii = 0; ii < boxdims; ii++) {
-	colcounter = 0;
-	for (b = 0; b < boxdims; b++) {
-	    // Read the bitmask 
-	    if (bpix[ii + (boxdims * b)] == 1)
-		colcounter++;	// counter the number of events in the col
+    // Move the box for the next plane onto this centroid unless that
+    // would take it off the frame
+    if (tracking && foundarray[j]
+	&& (floor(Bx + 0.5) != boxx || floor(By + 0.5) != boxy)) {
+	if (floor(Bx + 0.5) - stars.box[j] / 2 < 1
+	    || floor(By + 0.5) - stars.box[j] / 2 < 1
+	    || floor(Bx + 0.5) + stars.box[j] / 2 - 1 > anaxes[0]
+	    || floor(By + 0.5) + stars.box[j] / 2 - 1 > anaxes[1])
+	    fprintf(out,
+		    "Edge warning: box for star %d cannot follow it past the frame edge\n",
+		    j + 1);
+	else {
+	    boxxarray[j] = floor(Bx + 0.5);
+	    boxyarray[j] = floor(By + 0.5);
+	    if (cleanmode == 1)
+		read_master_box(mffptr, mbfptr, boxxarray[j], boxyarray[j],
+				stars.box[j], bpix[j], cpix[j]);
 	}
-	Bx += colcounter * ii;	// By count of pixel row elements
     }
-
-    *x = (Bx / pixelmaskcounter) + xpos - (boxdims / 2);	// return the global location in the frame 
-    *y = (By / pixelmaskcounter) + ypos - (boxdims / 2);
-
-    free(bpix);
-
-    return *x, *y;
-
 }
 
-// Caclulate the distance between a pixel point and the centre of the point source/star
-double
-euclidian_dist(int pixelxpos, int pixelypos, double centx, double centy)
+//
+// The Julian date of a data file, from the JD keyword cleanobjectfile writes or
+// else from DATE in the same way cleanobjectfile computes it
+//
+double file_jd(fitsfile * datafptr, const char *filename)
 {
-    return
-	sqrt((((double) pixelxpos - centx) * ((double) pixelxpos -
-					      centx)) +
-	     (((double) pixelypos - centy) * ((double) pixelypos -
-					      centy)));
+    int status = 0, year, month, day, hour, minute, a, y, m;
+    double jd, second;
+    char date[FLEN_VALUE];
+
+    if (fits_read_key(datafptr, TDOUBLE, "JD", &jd, NULL, &status) == 0)
+	return jd;
+    status = 0;
+    if (fits_read_key(datafptr, TSTRING, "DATE", date, NULL, &status)
+	|| fits_str2time(date, &year, &month, &day, &hour, &minute,
+			 &second, &status))
+	bail("%s has no JD or DATE keyword to time the light curves\n",
+	     filename);
+
+    a = (14 - month) / 12;
+    y = year + 4800 - a;
+    m = month + 12 * a - 3;
+    return day + (153 * m + 2) / 5 + 365 * y + y / 4 - y / 100 + y / 400 -
+	32045 + (hour - 12) / 24.0 + minute / 1440.0 + second / 86400;
 }
 
-int compare_doubles(const void *X, const void *Y)
+//
+// Append star j's records for the current file to its light curve as one block
+//
+void flush_lightcurve(int j)
 {
-    double x = *((double *) X);
-    double y = *((double *) Y);
+    double t0;
+
+    if (lightcurvedir == NULL)
+	return;
+    t0 = timer_now();
+    lc_append(lightcurvedir, j + 1, curves[j].rec, curves[j].nrecords);
+    curves[j].nrecords = 0;
+    stage_stop(STAGE_OUTPUT, t0);
+}
 
-    if (x > y) {
-	return 1;
-    } else {
-	if (x < y) {
-	    return -1;
-	} else {
-	    return 0;
-	}
+//
+// Read rows first..last of a plane into buf
+//
+static void read_rows(fitsfile * datafptr, long plane, long width,
+		      long first, long last, double *buf)
+{
+    long fpixel[3] = { 1, first, plane };
+    int status = 0;
+    double t0 = timer_now();
+
+    if (fits_read_pix(datafptr, TDOUBLE, fpixel, (last - first + 1) * width,
+		      NULL, buf, NULL, &status)) {
+	fits_report_error(stderr, status);	// print error message
+	bail("Failed to read rows %ld to %ld of image %ld\n", first, last,
+	     plane);
     }
+    stage_stop(STAGE_READ, t0);
 }
 
-
-int file_select(struct direct *entry)
+//
+// Process every star a plane at a time (-p). Each plane is read once, in
+// strips of striprows full width rows (the whole plane when striprows is 0),
+// and the star boxes are copied out of the rows in memory, so the number of
+// reads no longer grows with the number of stars. Stars are indexed by the
+// strip holding the last row of their box; a strip's stars are processed once
+// the rows from the first row of their boxes to the end of the strip are in
+// the buffer, which keeps up to striprows + the largest box rows. Strips with
+// no stars are never read. Each star's results go to its own memory stream
+// and are written out in star order at the end so the result file matches the
+// one written star by star.
+//
+void process_by_plane(fitsfile * datafptr, long *anaxes,
+		      const char *filename)
 {
+    long width = anaxes[0], height = anaxes[1], rows = striprows, nstrips;
+    long plane, fpixel[2], lpixel[2], lo, hi, bufstart, bufend, s, k, r;
+    long *first, *order, maxbox = 0;
+    int j;
+    double *buf, *apix, t0;
+    FILE **out;
+    char **outbuf;
+    size_t *outlen;
+
+    if (rows <= 0 || rows > height)
+	rows = height;
+    nstrips = (height + rows - 1) / rows;
+    for (j = 0; j < stars.nstars; j++)
+	if (stars.box[j] > maxbox)
+	    maxbox = stars.box[j];
+
+    buf = (double *) malloc((rows + maxbox) * width * sizeof(double));
+    apix = (double *) malloc(maxbox * maxbox * sizeof(double));
+    first = (long *) malloc((nstrips + 1) * sizeof(long));
+    order = (long *) malloc(stars.nstars * sizeof(long));
+    out = (FILE **) malloc(stars.nstars * sizeof(FILE *));
+    outbuf = (char **) calloc(stars.nstars, sizeof(char *));
+    outlen = (size_t *) calloc(stars.nstars, sizeof(size_t));
+    if (buf == NULL || apix == NULL || first == NULL || order == NULL
+	|| out == NULL || outbuf == NULL || outlen == NULL)
+	bail("Memory allocation error\n");
 
-    char *ptr;
+    for (j = 0; j < stars.nstars; j++) {
+	if ((out[j] = open_memstream(&outbuf[j], &outlen[j])) == NULL)
+	    bail("Memory allocation error\n");
+	star_start(j, out[j]);
+    }
 
-    if ((strcmp(entry->d_name, ".") == 0)
-	|| (strcmp(entry->d_name, "..") == 0))
-	return (FALSE);
+    for (plane = 1; plane <= anaxes[2]; plane++) {
+	// Index the stars by strip, boxes move from plane to plane when tracking
+	memset(first, 0, (nstrips + 1) * sizeof(long));
+	for (j = 0; j < stars.nstars; j++) {
+	    star_box(j, fpixel, lpixel);
+	    if (lpixel[0] > width || lpixel[1] > height)
+		bail("Not able to get a box area around the x,y coordinate %d %d %d %d\n", fpixel[0], fpixel[1], lpixel[0], lpixel[1]);
+	    first[(lpixel[1] - 1) / rows + 1]++;
+	}
+	for (s = 0; s < nstrips; s++)
+	    first[s + 1] += first[s];
+	for (j = 0; j < stars.nstars; j++) {
+	    star_box(j, fpixel, lpixel);
+	    order[first[(lpixel[1] - 1) / rows]++] = j;
+	}
+	for (s = nstrips; s > 0; s--)	// restore the strip starts
+	    first[s] = first[s - 1];
+	first[0] = 0;
+
+	bufstart = 1;
+	bufend = 0;	// rows bufstart..bufend of the plane are in buf
+	for (s = 0; s < nstrips; s++) {
+	    if (first[s] == first[s + 1])
+		continue;
+
+	    // Rows needed by this strip's stars
+	    lo = height;
+	    hi = 1;
+	    for (k = first[s]; k < first[s + 1]; k++) {
+		star_box(order[k], fpixel, lpixel);
+		if (fpixel[1] < lo)
+		    lo = fpixel[1];
+		if (lpixel[1] > hi)
+		    hi = lpixel[1];
+	    }
+	    if (lo < bufstart || lo > bufend) {
+		read_rows(datafptr, plane, width, lo, hi, buf);
+	    } else {
+		memmove(buf, buf + (lo - bufstart) * width,
+			(bufend - lo + 1) * width * sizeof(double));
+		if (hi > bufend)
+		    read_rows(datafptr, plane, width, bufend + 1, hi,
+			      buf + (bufend + 1 - lo) * width);
+		else
+		    hi = bufend;
+	    }
+	    bufstart = lo;
+	    bufend = hi;
+
+	    for (k = first[s]; k < first[s + 1]; k++) {
+		j = order[k];
+		star_box(j, fpixel, lpixel);
+		for (r = 0; r < stars.box[j]; r++)
+		    memcpy(apix + r * (long) stars.box[j],
+			   buf + (fpixel[1] - bufstart + r) * width +
+			   fpixel[0] - 1, stars.box[j] * sizeof(double));
+		star_plane(j, plane, apix, out[j], anaxes, filename);
+	    }
+	}
+    }
 
-    /* Check for filename extensions */
-    ptr = strrchr(entry->d_name, '.');
-    return ((ptr != NULL) && (strcmp(ptr, ".fits") == 0));
+    t0 = timer_now();
+    for (j = 0; j < stars.nstars; j++) {
+	fclose(out[j]);
+	fwrite(outbuf[j], 1, outlen[j], fp);
+	free(outbuf[j]);
+    }
+    stage_stop(STAGE_OUTPUT, t0);
+
+    free(buf);
+    free(apix);
+    free(first);
+    free(order);
+    free(out);
+    free(outbuf);
+    free(outlen);
 }
@@ -0,0 +1,262 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "fitsio.h"
+#include "catalog.h"
+
+#define BUFSIZE 2056
+
+void bail(const char *msg, ...);
+
+/*
+*      catalog: Load the acn-aphot star list from a config file or a FITS table.
+*
+*                 The text format is the config file read by acn-aphot, one star per line:
+*
+*                   X Y Radius Annulus Dannulus boxwidth Threshold ! comment
+*
+*                 with lines starting ! ignored. A FITS table needs the columns X, Y, RADIUS,
+*                 ANNULUS, DANNULUS, BOX and THRESHOLD (any case) with one row per star.
+*                 The arrays grow by doubling so there is no limit on the number of stars.
+*
+*                 Radius sets the apertures measured for the star and may be written as
+*
+*                   15          MINRADIUS, MINRADIUS + 1, .. 14 (the original sweep)
+*                   4:10        4, 5, .. 10
+*                   4:10:0.5    4, 4.5, .. 10
+*                   3,5,8       exactly these radii
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+void catalog_init(struct catalog *cat)
+{
+    memset(cat, 0, sizeof(*cat));
+}
+
+// Make room for at least n stars
+static void catalog_reserve(struct catalog *cat, long n)
+{
+    double **field[7] = { &cat->x, &cat->y, &cat->radius, &cat->annulus,
+	&cat->dannulus, &cat->box, &cat->threshold
+    };
+    long size = cat->allocated ? cat->allocated : 64;
+    int f;
+
+    if (n <= cat->allocated)
+	return;
+    while (size < n)
+	size *= 2;
+    for (f = 0; f < 7; f++) {
+	*field[f] = (double *) realloc(*field[f], size * sizeof(double));
+	if (*field[f] == NULL)
+	    bail("Memory allocation error\n");
+    }
+    cat->radiusfirst =
+	(long *) realloc(cat->radiusfirst, size * sizeof(long));
+    cat->nradii = (int *) realloc(cat->nradii, size * sizeof(int));
+    if (cat->radiusfirst == NULL || cat->nradii == NULL)
+	bail("Memory allocation error\n");
+    cat->allocated = size;
+}
+
+// Append one radius to the pool
+static void pool_add(struct catalog *cat, double radius)
+{
+    if (cat->npool == cat->poolallocated) {
+	cat->poolallocated = cat->poolallocated ? 2 * cat->poolallocated : 1024;
+	cat->radii = (double *) realloc(cat->radii,
+					cat->poolallocated * sizeof(double));
+	if (cat->radii == NULL)
+	    bail("Memory allocation error\n");
+    }
+    cat->radii[cat->npool++] = radius;
+}
+
+//
+// Add the radii described by spec for star s to the pool and set its largest
+// radius. The forms are described at the top of the file.
+//
+static void parse_radii(struct catalog *cat, long s, const char *spec)
+{
+    double rmin, rmax, step = 1, r;
+    char *end;
+    const char *p;
+    long n;
+
+    cat->radiusfirst[s] = cat->npool;
+    cat->radius[s] = 0;
+    if (strchr(spec, ',') != NULL) {	// explicit list
+	for (p = spec; *p != '\0'; p = *end == ',' ? end + 1 : end) {
+	    r = strtod(p, &end);
+	    if (end == p || r <= 0)
+		bail("invalid config file Radius value %s\n", spec);
+	    pool_add(cat, r);
+	    if (r > cat->radius[s])
+		cat->radius[s] = r;
+	}
+    } else if (strchr(spec, ':') != NULL) {	// min:max[:step], max included
+	rmin = strtod(spec, &end);
+	rmax = strtod(end + 1, &end);
+	if (*end == ':')
+	    step = strtod(end + 1, &end);
+	if (rmin <= 0 || rmax < rmin || step <= 0)
+	    bail("invalid config file Radius value %s\n", spec);
+	// Count the steps so rounding cannot drop or add the last radius
+	for (n = 0; n <= (long) ((rmax - rmin) / step + 1e-9); n++)
+	    pool_add(cat, rmin + n * step);
+	cat->radius[s] = rmin + (n - 1) * step;
+    } else {	// original sweep up to but not including the radius
+	rmax = atof(spec);
+	for (r = MINRADIUS; r < rmax; r++) {
+	    pool_add(cat, r);
+	    cat->radius[s] = r;
+	}
+    }
+    cat->nradii[s] = cat->npool - cat->radiusfirst[s];
+}
+
+void catalog_add(struct catalog *cat, double x, double y,
+		 const char *radius, double annulus, double dannulus,
+		 double box, double threshold)
+{
+    long s = cat->nstars;
+
+    catalog_reserve(cat, s + 1);
+    cat->x[s] = x;
+    cat->y[s] = y;
+    parse_radii(cat, s, radius);
+    cat->annulus[s] = annulus;
+    cat->dannulus[s] = dannulus;
+    cat->box[s] = box;
+    cat->threshold[s] = threshold;
+    cat->nstars++;
+}
+
+// Next space separated config value, zero when the line has run out. The
+// token itself is copied to text when that is given.
+static double config_value(char *line, char *text)
+{
+    char *tok = strtok(line, " ");
+
+    if (tok != NULL && text != NULL)
+	strcpy(text, tok);
+    return tok == NULL ? 0 : atof(tok);
+}
+
+//
+// Read a config file. Every value must be non zero, as in the original
+// acn-aphot parser, so a short or malformed line stops the run.
+//
+void catalog_read_text(struct catalog *cat, FILE * fp)
+{
+    char buf[BUFSIZE], radius[BUFSIZE];
+    double v[7];
+    const char *names[7] = { "X", "Y", "Radius", "annulus", "dannulus",
+	"boxarry", "threshold"
+    };
+    int f;
+
+    while (fgets(buf, BUFSIZE, fp) != NULL) {
+	if (buf[0] == '!')
+	    continue;		// We just ignore the comment lines
+	errno = 0;
+	for (f = 0; f < 7; f++) {
+	    v[f] = config_value(f == 0 ? buf : NULL, f == 2 ? radius : NULL);
+	    if (v[f] == 0)
+		bail("invalid config file %s value", names[f]);
+	}
+	if (errno != 0)
+	    bail("Invalid config file detected");
+	catalog_add(cat, v[0], v[1], radius, v[3], v[4], v[5], v[6]);
+    }
+}
+
+// Read the star list from the first table extension of a FITS file
+void catalog_read_fits(struct catalog *cat, const char *filename)
+{
+    fitsfile *fptr;
+    int status = 0, f, col, anynul;
+    long nrows, first = cat->nstars;
+    double **field[7] = { &cat->x, &cat->y, &cat->radius, &cat->annulus,
+	&cat->dannulus, &cat->box, &cat->threshold
+    };
+    char *names[7] = { "X", "Y", "RADIUS", "ANNULUS", "DANNULUS", "BOX",
+	"THRESHOLD"
+    };
+
+    char **radius;
+    long s;
+
+    fits_open_table(&fptr, filename, READONLY, &status);
+    fits_get_num_rows(fptr, &nrows, &status);
+    if (status) {
+	fits_report_error(stderr, status);
+	bail("Unable to read the star table %s\n", filename);
+    }
+    catalog_reserve(cat, first + nrows);
+    radius = (char **) malloc(nrows * sizeof(char *));
+    if (radius == NULL)
+	bail("Memory allocation error\n");
+    for (s = 0; s < nrows; s++)
+	if ((radius[s] = (char *) malloc(FLEN_VALUE)) == NULL)
+	    bail("Memory allocation error\n");
+
+    for (f = 0; f < 7; f++) {
+	if (fits_get_colnum(fptr, CASEINSEN, names[f], &col, &status))
+	    bail("Star table %s has no %s column\n", filename, names[f]);
+	// RADIUS is read as text so it can hold a range or list of radii
+	if (f == 2)
+	    fits_read_col(fptr, TSTRING, col, 1, 1, nrows, NULL, radius,
+			  &anynul, &status);
+	else
+	    fits_read_col(fptr, TDOUBLE, col, 1, 1, nrows, NULL,
+			  *field[f] + first, &anynul, &status);
+	if (status) {
+	    fits_report_error(stderr, status);
+	    bail("Failed to read the %s column of %s\n", names[f],
+		 filename);
+	}
+    }
+    fits_close_file(fptr, &status);
+    for (s = 0; s < nrows; s++) {
+	parse_radii(cat, first + s, radius[s]);
+	free(radius[s]);
+    }
+    free(radius);
+    cat->nstars = first + nrows;
+}
+
+// Read a config file or FITS table, telling them apart by the FITS signature
+void catalog_read(struct catalog *cat, const char *filename)
+{
+    FILE *fp;
+    char magic[7] = "";
+
+    if ((fp = fopen(filename, "r")) == NULL)
+	bail("Unable to open star list %s\n", filename);
+    if (fread(magic, 1, 6, fp) == 6 && strcmp(magic, "SIMPLE") == 0) {
+	fclose(fp);
+	catalog_read_fits(cat, filename);
+	return;
+    }
+    rewind(fp);
+    catalog_read_text(cat, fp);
+    fclose(fp);
+}
+
+void catalog_free(struct catalog *cat)
+{
+    free(cat->x);
+    free(cat->y);
+    free(cat->radius);
+    free(cat->annulus);
+    free(cat->dannulus);
+    free(cat->box);
+    free(cat->threshold);
+    free(cat->radiusfirst);
+    free(cat->nradii);
+    free(cat->radii);
+    catalog_init(cat);
+}
@@ -0,0 +1,40 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdio.h>
+
+#define MINRADIUS 2		// first radius of a sweep given as a single radius
+
+/*
+*      catalog.h: The star list processed by acn-aphot, held as one array per field so
+*                 the per star loops walk contiguous memory whatever the number of stars.
+*                 The aperture radii of all stars are kept in one pool, star s uses
+*                 radii[radiusfirst[s]] .. radii[radiusfirst[s] + nradii[s] - 1].
+*
+*        Each program provides its own bail() which the loaders call on fatal errors.
+*/
+
+struct catalog {
+    long nstars;		// stars in the list
+    long allocated;		// room in each array
+    double *x, *y;		// initial guess of the star position (FITS pixels)
+    double *radius;	// largest aperture radius of the star
+    double *annulus, *dannulus;
+    double *box;		// width of the box read around the star
+    double *threshold;	// centroid mask threshold
+    long *radiusfirst;	// start of the star's radii in the pool
+    int *nradii;	// number of radii for the star
+    double *radii;	// pool of aperture radii
+    long npool, poolallocated;
+};
+
+void catalog_init(struct catalog *cat);
+void catalog_add(struct catalog *cat, double x, double y,
+		 const char *radius, double annulus, double dannulus,
+		 double box, double threshold);
+void catalog_read_text(struct catalog *cat, FILE * fp);
+void catalog_read_fits(struct catalog *cat, const char *filename);
+void catalog_read(struct catalog *cat, const char *filename);
+void catalog_free(struct catalog *cat);
+
+#endif
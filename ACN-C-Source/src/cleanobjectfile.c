@@ -9,6 +9,7 @@
 #include <sys/resource.h>
 
 #include <strings.h>
+#include "fitshdr.h"
 
 double 	pr_julian_date (int year, int month, int day,int hour, int minute, double second);
 int 	pr_update_date ( fitsfile *fptr, double jd, int *status);
@@ -72,6 +73,9 @@ int main(int argc, char *argv[])
     int path_max = pathconf(".", _PC_NAME_MAX);
     char fullfilename[path_max];  //to store path and filename
     struct rlimit rl;
+    char **paths, errmsg[1024];
+    struct fits_image same;
+    long bad;
 
 	int length;
 	 char *to,*subrectstring;
@@ -148,6 +152,26 @@ int main(int argc, char *argv[])
     if (( anaxes[0] != bnaxes[0] || anaxes[1] != bnaxes[1] ))
         bail("Error: input images don't have same size\n");
 
+    // Check every data file from its header before cleaning any of them, in parallel.
+    // A bad or truncated file, or one which is not the size of the masters, stops the
+    // program here rather than part way through the directory.
+    paths = (char **)calloc(count > 0 ? count : 1, sizeof(char *));
+    if (paths == NULL) { bail("Memory allocation error\n"); }
+    for (i=0;i<count;++i) {
+        snprintf(fullfilename, path_max - 1, "%s%s", argv[1], files[i]->d_name);
+        if ((paths[i] = strdup(fullfilename)) == NULL) { bail("Memory allocation error\n"); }
+    }
+    same.naxes[0] = anaxes[0];
+    same.naxes[1] = anaxes[1];
+    bad = fitshdr_check_images(paths, count, 3, &same, NULL, errmsg, sizeof(errmsg));
+    if (bad > 0) {
+        bail("Error: %ld of %d data files are not usable, the first: %s\n", bad, count, errmsg);
+    }
+    for (i=0;i<count;++i) {
+        free(paths[i]);
+    }
+    free(paths);
+
 
 
 	//
@@ -1,113 +1,99 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
 #include "fitsio.h"
+#include "fitsdiff.h"
 
 /*
-** Compare 2 2D images for exactly the same values and print out any differences
+*      compare: Compare two images or cubes pixel by pixel and report how they differ.
+*
+*                 Every plane is compared, streamed through in large blocks (see fitsdiff.c).
+*                 A pixel matches when it is within any of the tolerances given, with no
+*                 tolerance the original 0.001 absolute tolerance is used. The summary gives
+*                 the pixels checked and differing, the largest absolute difference and where
+*                 it is, the RMS difference, the largest relative and ULP differences and the
+*                 first differing pixels. -o writes the difference image a - b.
+*
+*                 The exit status is 0 when the images match, 1 when they differ and 2 when
+*                 they could not be compared.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
 */
 
-int main(int argc, char *argv[])
+void usage(void)
 {
-    fitsfile *afptr, *bfptr, *outfptr;  /* FITS file pointers */
-    int status = 0;  /* CFITSIO status value MUST be initialized to zero! */
-    int atype, btype, anaxis, bnaxis, check = 1, ii, op,counter=0,errorcounter=0;
-    long npixels = 1, firstpix[3] = {1,1,1}, ntodo;
-    long anaxes[3] = {1,1,1}, bnaxes[3]={1,1,1};
-    double *apix, *bpix, value;
-
-    if (argc != 3) {
-      printf("Usage: imarith image1 image2 \n");
-      printf("\n");
-      printf("Examples: \n");
-      printf("  compare in1.fits in2.fits  compare the 2 files\n");
-      return(0);
-    }
+    fprintf(stderr, "Usage: compare [options] image1 image2\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -a abs     : absolute tolerance |a - b|\n");
+    fprintf(stderr, "  -r rel     : relative tolerance |a - b| / max(|a|, |b|)\n");
+    fprintf(stderr, "  -u ulp     : tolerance in units in the last place of a double\n");
+    fprintf(stderr, "  -n count   : differing pixels to list (default 10, at most %d)\n",
+	    DIFF_MAXLOCATIONS);
+    fprintf(stderr, "  -o diff    : write the difference image image1 - image2\n");
+    fprintf(stderr, "  -b pixels  : pixels read at a time (default %ld)\n", DIFF_BLOCK);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  With no tolerance pixels within 0.001 match, with several a pixel\n");
+    fprintf(stderr, "  matches when it is within any of them.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  compare in1.fits in2.fits                  compare the 2 files\n");
+    fprintf(stderr, "  compare -u 4 -o diff.fits in1.fits in2.fits\n\n");
+}
 
-    fits_open_file(&afptr, argv[1], READONLY, &status); /* open input images */
-    if (status) {
-       fits_report_error(stderr, status); /* print error message */
-       return(status);
-    }
-    fits_open_file(&bfptr, argv[2], READONLY, &status);
-    if (status) {
-	       fits_report_error(stderr, status); /* print error message */
-			return(status);
+int main(int argc, char *argv[])
+{
+    struct diff_options opt = { -1, -1, -1, 10, 0, NULL };
+    struct diff_stats *st;
+    char errmsg[FLEN_ERRMSG + FLEN_FILENAME];
+    int c;
+
+    while ((c = getopt(argc, argv, "a:r:u:n:o:b:h")) != -1) {
+	switch (c) {
+	case 'a':
+	    opt.abs = atof(optarg);
+	    break;
+	case 'r':
+	    opt.rel = atof(optarg);
+	    break;
+	case 'u':
+	    opt.ulp = atoll(optarg);
+	    break;
+	case 'n':
+	    opt.nlocations = atol(optarg);
+	    break;
+	case 'o':
+	    opt.diffimage = optarg;
+	    break;
+	case 'b':
+	    opt.block = atol(optarg);
+	    break;
+	default:
+	    usage();
+	    return 2;
+	}
     }
-
-    fits_get_img_dim(afptr, &anaxis, &status);  /* read dimensions */
-    fits_get_img_dim(bfptr, &bnaxis, &status);
-    fits_get_img_size(afptr, 3, anaxes, &status);
-    fits_get_img_size(bfptr, 3, bnaxes, &status);
-
-    if (status) {
-       fits_report_error(stderr, status); /* print error message */
-       return(status);
+    if (argc - optind != 2) {
+	usage();
+	return 2;
     }
+    if (opt.abs < 0 && opt.rel < 0 && opt.ulp < 0)
+	opt.abs = 0.001;
 
-    if (anaxis > 3) {
-       printf("Error: images with > 3 dimensions are not supported\n");
-       check = 0;
+    st = (struct diff_stats *) malloc(sizeof(*st));
+    if (st == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return 2;
     }
-         /* check that the input 2 images have the same size */
-    else if ( ( anaxes[0] != bnaxes[0] ||
-			  anaxes[1] != bnaxes[1] ||
-			  anaxes[2] != bnaxes[2] ) ) {
-        printf("Error: input images don't have same size\n");
-	printf ("anaxes[1] = %ld, bnaxeses[1] = %ld \n",anaxes[1],bnaxes[1]);
-	printf ("anaxes[2] = %ld, bnaxeses[2] = %ld \n",anaxes[2],bnaxes[2]);
-       //exit(0);
+    if (fitsdiff_files(argv[optind], argv[optind + 1], &opt, st, errmsg,
+		       sizeof(errmsg))) {
+	fprintf(stderr, "Error: %s\n", errmsg);
+	free(st);
+	return 2;
     }
-
-
-      npixels = anaxes[0];  /* no. of pixels to read in each row */
-      apix = (double *) malloc(npixels * sizeof(double)); /* mem for 1 row */
-      bpix = (double *) malloc(npixels * sizeof(double));
-
-      if (apix == NULL || bpix == NULL) {
-        printf("Memory allocation error\n");
-        return(1);
-  	  }
-
-
-  /* loop over all planes of the cube (2D images have 1 plane) */
-      for (firstpix[2] = 1; firstpix[2] <= 1; firstpix[2]++)
-     // for (firstpix[2] = 1; firstpix[2] <= anaxes[2]; firstpix[2]++)
-      {
-        /* loop over all rows of the plane */
-        for (firstpix[1] = 1; firstpix[1] <= anaxes[1]; firstpix[1]++)
-        {
-          /* Read both images as doubles, regardless of actual datatype.  */
-          /* Give starting pixel coordinate and no. of pixels to read.    */
-          /* This version does not support undefined pixels in the image. */
-
-          if (fits_read_pix(afptr, TDOUBLE, firstpix, npixels, NULL, apix,
-                            NULL, &status))
-	    	break;   /* jump out of loop on error */
-	  	  if (fits_read_pix(bfptr, TDOUBLE, firstpix, npixels,
-				      NULL, bpix, NULL, &status))
-	    	break;   /* jump out of loop on error */
-
-          for(ii=0; ii< npixels; ii++) 
-	      if ((apix[ii]-bpix[ii] > 0.001) || (bpix[ii]-apix[ii] > 0.001) ) {
-			  	printf ("diff = %f   ",apix[ii]-bpix[ii]);
-				printf ("plane = %ld, r %ld, c %d, %*.*f, %*.*f\n",firstpix[2],firstpix[1],ii,11,14,apix[ii],11,14,bpix[ii]);
-			  	errorcounter++;
-	  
-		}
-		else counter++;
-        }
-      }    /* end of loop over planes */
-
-
-    printf ("The number of items checked %d - differences = %d\n",counter,errorcounter);
-
-    free(apix);
-    free(bpix);
-
-    fits_close_file(afptr, &status);
-    fits_close_file(bfptr, &status);
-
-    if (status) fits_report_error(stderr, status); /* print any error message */
-    return(status);
+    diff_report(stdout, st, opt.nlocations);
+    c = st->differ > 0;
+    free(st);
+    return c;
 }
-
@@ -0,0 +1,401 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "fitsio.h"
+#include "catalog.h"
+
+/*
+*      cutout: Cut the box around every star of a config out of each data file and write
+*              the boxes as tile compressed FITS files, the clipped dataset.
+*
+*                 The stars are read as acn-aphot reads them (see catalog.c), each cutout is
+*                 the star's box width square centred on its x y, clipped to the image. Each
+*                 plane of an input is read once, as the band of rows holding all the boxes,
+*                 and every box is written from it straight into its compressed output,
+*                 outdir/starN-name.fz. Other keywords are copied from the input, CRPIX1/2
+*                 are moved with the box and LTV1/2 record where it was cut from.
+*
+*                 Files are cut concurrently, one per thread. CFITSIO must be built with
+*                 --enable-reentrant for more than one thread, a library built without it
+*                 is used from a single thread.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+#define BUFSIZE 2056
+
+static struct catalog stars;
+static const char *outdir = "./compressed";
+static int compression = RICE_1, quiet;
+static long width;			// box width overriding the config, 0 for none
+static char **inputs;
+static long ninputs, nextinput, failed;	// protected by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: cutout [options] config file|dir...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -o dir      : directory for the cutouts (default ./compressed)\n");
+    fprintf(stderr, "  -w pixels   : width of every box (default the box width of each star)\n");
+    fprintf(stderr, "  -z type     : rice, gzip, hcompress or none (default rice, as fpack)\n");
+    fprintf(stderr, "  -j threads  : files cut at once (default one per core)\n");
+    fprintf(stderr, "  -q          : do not list the files as they are cut\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  A directory stands for the .fits files in it. The config is a star list\n");
+    fprintf(stderr, "  as for acn-aphot.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  cutout -w 83 MasterFiles/config /mnt/storage1/AstronomyData/ExpA/dataset1\n");
+    fprintf(stderr, "  cutout -o clipped -z none config bf00001.fits bf00002.fits\n\n");
+}
+
+static void add_input(const char *path)
+{
+    static long allocated;
+
+    if (ninputs == allocated) {
+	allocated = allocated ? 2 * allocated : 256;
+	inputs = (char **) realloc(inputs, allocated * sizeof(char *));
+	if (inputs == NULL)
+	    bail("Memory allocation error\n");
+    }
+    if ((inputs[ninputs++] = strdup(path)) == NULL)
+	bail("Memory allocation error\n");
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Add path, or the .fits files in it when it is a directory
+static void add_inputs(const char *path)
+{
+    struct stat sb;
+    struct dirent *e;
+    DIR *d;
+    char file[BUFSIZE];
+    const char *ext;
+    long first = ninputs;
+
+    if (stat(path, &sb) != 0)
+	bail("Unable to find %s\n", path);
+    if (!S_ISDIR(sb.st_mode)) {
+	add_input(path);
+	return;
+    }
+    if ((d = opendir(path)) == NULL)
+	bail("Unable to read directory %s\n", path);
+    while ((e = readdir(d)) != NULL) {
+	ext = strrchr(e->d_name, '.');
+	if (ext == NULL || strcmp(ext, ".fits") != 0)
+	    continue;
+	snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+	add_input(file);
+    }
+    closedir(d);
+    qsort(inputs + first, ninputs - first, sizeof(char *), compare_names);
+}
+
+//
+// Copy the keywords of in which do not describe the image layout, its scaling
+// or its checksum to out
+//
+static void copy_keywords(fitsfile * in, fitsfile * out, int *status)
+{
+    char card[FLEN_CARD];
+    int nkeys, k, class;
+
+    fits_get_hdrspace(in, &nkeys, NULL, status);
+    for (k = 1; k <= nkeys && !*status; k++) {
+	fits_read_record(in, k, card, status);
+	class = fits_get_keyclass(card);
+	if (class == TYP_STRUC_KEY || class == TYP_CMPRS_KEY
+	    || class == TYP_SCAL_KEY || class == TYP_CKSUM_KEY)
+	    continue;
+	fits_write_record(out, card, status);
+    }
+}
+
+// Move a reference pixel keyword of out by shift when it is present
+static void shift_key(fitsfile * in, fitsfile * out, const char *key,
+		      double shift, int *status)
+{
+    double v;
+
+    if (*status)
+	return;
+    if (fits_read_key(in, TDOUBLE, key, &v, NULL, status) == KEY_NO_EXIST) {
+	*status = 0;
+	return;
+    }
+    v -= shift;
+    fits_update_key(out, TDOUBLE, key, &v, NULL, status);
+}
+
+//
+// Cut every star out of path. Returns 0 when all the cutouts were written,
+// otherwise non zero with the reason in errmsg.
+//
+static int cut_file(const char *path, char *errmsg, size_t errlen)
+{
+    fitsfile *in = NULL, **out;
+    int status = 0, naxis, imgtype, k;
+    long naxes[3] = { 1, 1, 1 }, s, w, *x0, *y0, *nx, *ny, ymin, ymax,
+	fpixel[3], opixel[3] = { 1, 1, 1 }, row, plane, onaxes[3];
+    double *band = NULL, *box = NULL, v;
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    char outpath[BUFSIZE], fitserr[FLEN_ERRMSG], history[FLEN_CARD];
+
+    out = (fitsfile **) calloc(stars.nstars, sizeof(fitsfile *));
+    x0 = (long *) malloc(4 * stars.nstars * sizeof(long));
+    if (out == NULL || x0 == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	free(out);
+	free(x0);
+	return 1;
+    }
+    y0 = x0 + stars.nstars;
+    nx = y0 + stars.nstars;
+    ny = nx + stars.nstars;
+
+    fits_open_file(&in, path, READONLY, &status);
+    fits_get_img_dim(in, &naxis, &status);
+    fits_get_img_size(in, 3, naxes, &status);
+    fits_get_img_equivtype(in, &imgtype, &status);
+    if (status)
+	goto done;
+    if (naxis < 2 || naxis > 3) {
+	snprintf(errmsg, errlen, "%s: only 2 and 3 dimensional images are cut",
+		 path);
+	status = -1;
+	goto done;
+    }
+
+    // The boxes clipped to the image, and the band of rows holding them all
+    ymin = naxes[1];
+    ymax = 1;
+    for (s = 0; s < stars.nstars; s++) {
+	w = width > 0 ? width : (long) stars.box[s];
+	x0[s] = (long) stars.x[s] - w / 2;
+	y0[s] = (long) stars.y[s] - w / 2;
+	nx[s] = x0[s] + w - 1 > naxes[0] ? naxes[0] - x0[s] + 1 : w;
+	ny[s] = y0[s] + w - 1 > naxes[1] ? naxes[1] - y0[s] + 1 : w;
+	if (x0[s] < 1) {
+	    nx[s] -= 1 - x0[s];
+	    x0[s] = 1;
+	}
+	if (y0[s] < 1) {
+	    ny[s] -= 1 - y0[s];
+	    y0[s] = 1;
+	}
+	if (nx[s] < 1 || ny[s] < 1) {
+	    snprintf(errmsg, errlen, "%s: star %ld at %g %g is off the image",
+		     path, s + 1, stars.x[s], stars.y[s]);
+	    status = -1;
+	    goto done;
+	}
+	ymin = y0[s] < ymin ? y0[s] : ymin;
+	ymax = y0[s] + ny[s] - 1 > ymax ? y0[s] + ny[s] - 1 : ymax;
+    }
+
+    band = (double *) malloc(naxes[0] * (ymax - ymin + 1) * sizeof(double));
+    box = (double *) malloc(naxes[0] * (ymax - ymin + 1) * sizeof(double));
+    if (band == NULL || box == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	status = -1;
+	goto done;
+    }
+
+    for (s = 0; s < stars.nstars && !status; s++) {
+	snprintf(outpath, sizeof(outpath), "!%s/star%ld-%s.fz", outdir,
+		 s + 1, name);	// ! overwrites
+	if (compression == 0)
+	    outpath[strlen(outpath) - 3] = '\0';	// uncompressed, no .fz
+	fits_create_file(&out[s], outpath, &status);
+	if (compression != 0)
+	    fits_set_compression_type(out[s], compression, &status);
+	onaxes[0] = nx[s];
+	onaxes[1] = ny[s];
+	onaxes[2] = naxes[2];
+	fits_create_img(out[s], imgtype, naxis, onaxes, &status);
+	copy_keywords(in, out[s], &status);
+	shift_key(in, out[s], "CRPIX1", x0[s] - 1, &status);
+	shift_key(in, out[s], "CRPIX2", y0[s] - 1, &status);
+	v = 1 - x0[s];
+	fits_update_key(out[s], TDOUBLE, "LTV1", &v,
+			"offset of the cutout in the original", &status);
+	v = 1 - y0[s];
+	fits_update_key(out[s], TDOUBLE, "LTV2", &v,
+			"offset of the cutout in the original", &status);
+	snprintf(history, sizeof(history), "cutout [%ld:%ld,%ld:%ld] of %s",
+		 x0[s], x0[s] + nx[s] - 1, y0[s], y0[s] + ny[s] - 1, name);
+	fits_write_history(out[s], history, &status);
+    }
+
+    for (plane = 1; plane <= naxes[2] && !status; plane++) {
+	fpixel[0] = 1;
+	fpixel[1] = ymin;
+	fpixel[2] = plane;
+	if (fits_read_pix(in, TDOUBLE, fpixel, naxes[0] * (ymax - ymin + 1),
+			  NULL, band, NULL, &status))
+	    break;
+	for (s = 0; s < stars.nstars; s++) {
+	    for (row = 0; row < ny[s]; row++)
+		memcpy(box + row * nx[s],
+		       band + (y0[s] - ymin + row) * naxes[0] + x0[s] - 1,
+		       nx[s] * sizeof(double));
+	    opixel[2] = plane;
+	    if (fits_write_pix(out[s], TDOUBLE, opixel, nx[s] * ny[s], box,
+			       &status))
+		break;
+	}
+    }
+
+  done:
+    if (status > 0) {
+	fits_get_errstatus(status, fitserr);
+	snprintf(errmsg, errlen, "%s: %s", path, fitserr);
+    }
+    for (s = 0; s < stars.nstars; s++) {
+	k = 0;
+	if (out[s] != NULL)
+	    fits_close_file(out[s], &k);
+    }
+    k = 0;
+    if (in != NULL)
+	fits_close_file(in, &k);
+    free(band);
+    free(box);
+    free(out);
+    free(x0);
+    return status;
+}
+
+// Worker: cut the next input until none are left
+static void *worker(void *arg)
+{
+    char errmsg[BUFSIZE];
+    long i;
+
+    (void) arg;
+    for (;;) {
+	pthread_mutex_lock(&lock);
+	i = nextinput < ninputs ? nextinput++ : -1;
+	pthread_mutex_unlock(&lock);
+	if (i < 0)
+	    break;
+	errmsg[0] = '\0';
+	if (cut_file(inputs[i], errmsg, sizeof(errmsg))) {
+	    pthread_mutex_lock(&lock);
+	    failed++;
+	    fprintf(stderr, "Error: %s\n", errmsg);
+	    pthread_mutex_unlock(&lock);
+	} else if (!quiet)
+	    printf("Cut %ld stars from %s\n", stars.nstars, inputs[i]);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t *threads;
+    int nthreads = 0, c, t;
+    long i;
+
+    while ((c = getopt(argc, argv, "o:w:z:j:qh")) != -1) {
+	switch (c) {
+	case 'o':
+	    outdir = optarg;
+	    break;
+	case 'w':
+	    width = atol(optarg);
+	    break;
+	case 'z':
+	    if (strcmp(optarg, "rice") == 0)
+		compression = RICE_1;
+	    else if (strcmp(optarg, "gzip") == 0)
+		compression = GZIP_1;
+	    else if (strcmp(optarg, "hcompress") == 0)
+		compression = HCOMPRESS_1;
+	    else if (strcmp(optarg, "none") == 0)
+		compression = 0;
+	    else
+		bail("Unknown compression %s\n", optarg);
+	    break;
+	case 'j':
+	    nthreads = atoi(optarg);
+	    break;
+	case 'q':
+	    quiet = 1;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (argc - optind < 2) {
+	usage();
+	return 1;
+    }
+
+    catalog_init(&stars);
+    catalog_read(&stars, argv[optind]);
+    if (stars.nstars == 0)
+	bail("No stars in %s\n", argv[optind]);
+    for (i = optind + 1; i < argc; i++)
+	add_inputs(argv[i]);
+    if (ninputs == 0)
+	bail("No files to cut\n");
+    if (mkdir(outdir, 0777) != 0 && access(outdir, W_OK) != 0)
+	bail("Unable to create %s\n", outdir);
+
+    if (nthreads <= 0)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+	nthreads = 1;
+    if (nthreads > 1 && !fits_is_reentrant()) {
+	fprintf(stderr, "CFITSIO is not reentrant, cutting one file at a time\n");
+	nthreads = 1;
+    }
+    if (nthreads > ninputs)
+	nthreads = ninputs;
+
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    if (threads == NULL)
+	bail("Memory allocation error\n");
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&threads[t], NULL, worker, NULL) != 0)
+	    bail("Unable to start a thread\n");
+    for (t = 0; t < nthreads; t++)
+	pthread_join(threads[t], NULL);
+    free(threads);
+
+    printf("%ld files cut into %ld stars each, %ld failed\n",
+	   ninputs - failed, stars.nstars, failed);
+    for (i = 0; i < ninputs; i++)
+	free(inputs[i]);
+    free(inputs);
+    catalog_free(&stars);
+    return failed > 0;
+}
@@ -0,0 +1,174 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "ensemble.h"
+
+void bail(const char *msg, ...);
+
+/*
+*      ensemble: Differential magnitudes of a target star against a weighted ensemble of
+*                comparison stars, for every plane and every aperture radius of the target.
+*
+*                 The magnitudes are recorded as they are measured and written once the
+*                 whole data file has been processed, so no result text needs parsing.
+*                 For each plane and radius the comparison stars measured with the same
+*                 radius are weighted by 1 / sigma^2, where sigma = 1.0857 sqrt(S) / I is
+*                 the photon noise of the star's magnitude in counts, and
+*
+*                   dMag  = Mag(target) - sum(w Mag(comp)) / sum(w)
+*                   Error = sqrt(sigma(target)^2 + 1 / sum(w))
+*
+*                 Comparison stars with no centroid or no positive intensity on a plane
+*                 get no weight on that plane. The weights are written normalised to 1.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+//
+// Set up the ensemble from spec, target:comp,comp,.. using star numbers from 1
+//
+void ensemble_parse(struct ensemble *ens, const char *spec,
+		    const struct catalog *cat)
+{
+    const char *p;
+    char *end;
+    long star;
+    int c;
+
+    memset(ens, 0, sizeof(*ens));
+    ens->target = strtol(spec, &end, 10) - 1;
+    if (end == spec || *end != ':')
+	bail("Ensemble %s is not target:comp,comp,..\n", spec);
+    if (ens->target < 0 || ens->target >= cat->nstars)
+	bail("Ensemble target star %ld is not in the star list\n",
+	     ens->target + 1);
+
+    for (p = end; *p == ':' || *p == ','; p = end) {
+	star = strtol(p + 1, &end, 10) - 1;
+	if (end == p + 1)
+	    bail("Ensemble %s is not target:comp,comp,..\n", spec);
+	if (star < 0 || star >= cat->nstars)
+	    bail("Comparison star %ld is not in the star list\n", star + 1);
+	if (star == ens->target)
+	    bail("Star %ld cannot be both target and comparison\n",
+		 star + 1);
+	for (c = 0; c < ens->ncomp; c++)
+	    if (ens->comp[c] == star)
+		bail("Comparison star %ld is listed twice\n", star + 1);
+	ens->comp = (long *) realloc(ens->comp,
+				     (ens->ncomp + 1) * sizeof(long));
+	if (ens->comp == NULL)
+	    bail("Memory allocation error\n");
+	ens->comp[ens->ncomp++] = star;
+    }
+    if (*p != '\0')
+	bail("Ensemble %s is not target:comp,comp,..\n", spec);
+
+    ens->nradii = cat->nradii[ens->target];
+    ens->radii = cat->radii + cat->radiusfirst[ens->target];
+}
+
+//
+// Clear the magnitudes for a data file of nplanes planes
+//
+void ensemble_start(struct ensemble *ens, long nplanes)
+{
+    long i, n = (ens->ncomp + 1) * nplanes * ens->nradii;
+
+    if (n > ens->allocated) {
+	ens->mag = (double *) realloc(ens->mag, n * sizeof(double));
+	ens->err = (double *) realloc(ens->err, n * sizeof(double));
+	if (ens->mag == NULL || ens->err == NULL)
+	    bail("Memory allocation error\n");
+	ens->allocated = n;
+    }
+    for (i = 0; i < n; i++)
+	ens->mag[i] = ens->err[i] = NAN;
+    ens->nplanes = nplanes;
+}
+
+//
+// Record the measurement of a star on a plane (from 1). Stars outside the
+// ensemble and radii the target is not measured with are ignored.
+//
+void ensemble_record(struct ensemble *ens, long star, long plane,
+		     double radius, double sum, double intensity,
+		     double magnitude)
+{
+    long i;
+    int m, k;
+
+    if (star == ens->target)
+	m = 0;
+    else {
+	for (m = 1; m <= ens->ncomp && ens->comp[m - 1] != star; m++);
+	if (m > ens->ncomp)
+	    return;
+    }
+    for (k = 0; k < ens->nradii && ens->radii[k] != radius; k++);
+    if (k == ens->nradii || plane < 1 || plane > ens->nplanes)
+	return;
+
+    i = ((m * ens->nplanes) + plane - 1) * ens->nradii + k;
+    ens->mag[i] = magnitude;
+    if (intensity > 0 && sum > 0 && isfinite(magnitude))
+	ens->err[i] = 1.0857 * sqrt(sum) / intensity;
+}
+
+//
+// Write the differential magnitudes and comparison weights of every plane
+//
+void ensemble_write(const struct ensemble *ens, FILE * out)
+{
+    double *w, wsum, msum, mag, err;
+    long p, i;
+    int c, k, used;
+
+    w = (double *) malloc(ens->ncomp * sizeof(double));
+    if (w == NULL)
+	bail("Memory allocation error\n");
+
+    fprintf(out, "Differential photometry of star %ld against stars",
+	    ens->target + 1);
+    for (c = 0; c < ens->ncomp; c++)
+	fprintf(out, " %ld", ens->comp[c] + 1);
+    fprintf(out, "\nImage  Radius      dMag    Error Ncomp  Weights\n");
+
+    for (p = 0; p < ens->nplanes; p++) {
+	for (k = 0; k < ens->nradii; k++) {
+	    wsum = msum = 0;
+	    used = 0;
+	    for (c = 0; c < ens->ncomp; c++) {
+		i = (((c + 1) * ens->nplanes) + p) * ens->nradii + k;
+		w[c] = 0;
+		if (isnan(ens->err[i]))
+		    continue;
+		w[c] = 1 / (ens->err[i] * ens->err[i]);
+		wsum += w[c];
+		msum += w[c] * ens->mag[i];
+		used++;
+	    }
+	    i = p * ens->nradii + k;
+	    mag = err = NAN;
+	    if (used > 0 && !isnan(ens->err[i])) {
+		mag = ens->mag[i] - msum / wsum;
+		err = sqrt(ens->err[i] * ens->err[i] + 1 / wsum);
+	    }
+	    fprintf(out, "%5ld %7.4g %9.5f %8.5f %5d ", p + 1,
+		    ens->radii[k], mag, err, used);
+	    for (c = 0; c < ens->ncomp; c++)
+		fprintf(out, " %6.4f", used > 0 ? w[c] / wsum : 0);
+	    fprintf(out, "\n");
+	}
+    }
+    free(w);
+}
+
+void ensemble_free(struct ensemble *ens)
+{
+    free(ens->comp);
+    free(ens->mag);
+    free(ens->err);
+    memset(ens, 0, sizeof(*ens));
+}
@@ -0,0 +1,34 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stdio.h>
+#include "catalog.h"
+
+/*
+*      ensemble.h: Differential photometry of a target star against an ensemble of
+*                  comparison stars, gathered while acn-aphot measures each plane.
+*                  Stars are numbered from 1 in config order, as in the result file.
+*
+*        Each program provides its own bail() which the ensemble calls on fatal errors.
+*/
+
+struct ensemble {
+    long target;		// star index of the target (from 0)
+    int ncomp;			// comparison stars
+    long *comp;			// star index of each comparison star
+    int nradii;			// radii of the target, the apertures compared
+    const double *radii;
+    long nplanes, allocated;	// planes in the current file, room in mag/err
+    double *mag, *err;		// [(member * nplanes + plane) * nradii + radius]
+};
+
+void ensemble_parse(struct ensemble *ens, const char *spec,
+		    const struct catalog *cat);
+void ensemble_start(struct ensemble *ens, long nplanes);
+void ensemble_record(struct ensemble *ens, long star, long plane,
+		     double radius, double sum, double intensity,
+		     double magnitude);
+void ensemble_write(const struct ensemble *ens, FILE * out);
+void ensemble_free(struct ensemble *ens);
+
+#endif
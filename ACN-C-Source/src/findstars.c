@@ -0,0 +1,406 @@
+#include <string.h>
+#include "fitsio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
+
+#define CELL 32			// background mesh cell width in pixels
+
+/*
+*      findstars: Detect the stars in a reference plane and write them as an acn-aphot config file.
+*
+*                 The plane (optionally cleaned with the master flat and bias) is split into
+*                 CELL x CELL cells and the background and noise of each cell estimated from
+*                 its median and median absolute deviation. The background map is bilinearly
+*                 interpolated between cell centres. Pixels more than nsigma above the local
+*                 background are grouped into 8-connected components in a single row major
+*                 labelling pass, and components with at least minpix pixels are kept as stars.
+*
+*                 Each star is written as a config line at its flux weighted centre with the
+*                 radius, annulus, dannulus and box given on the command line and a threshold a
+*                 quarter of the way up the star's peak. Stars are listed brightest first and
+*                 stars whose box would fall off the frame are dropped, as acn-aphot would
+*                 refuse them.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+// Detection parameters
+long plane = 1;
+int minpix = 5, maxstars = 0, boxdims = 80;
+double nsigma = 5, radius = 15, annulusval = 10, dannulusval = 15;
+
+// One detected component, accumulated while labelling
+struct component {
+    long npix;
+    double sum, sx, sy, peak, bg;
+};
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: findstars [options] objectfile > config\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -p plane    : plane of the cube to search (default 1)\n");
+    fprintf(stderr, "  -f flat     : master flat to clean the plane with (needs -b)\n");
+    fprintf(stderr, "  -b bias     : master bias to clean the plane with (needs -f)\n");
+    fprintf(stderr, "  -s nsigma   : detection level above the background in sigma (default 5)\n");
+    fprintf(stderr, "  -m minpix   : smallest number of pixels in a star (default 5)\n");
+    fprintf(stderr, "  -n stars    : keep only the brightest stars (default all)\n");
+    fprintf(stderr, "  -r radius   : radius written to the config (default 15)\n");
+    fprintf(stderr, "  -a annulus  : annulus written to the config (default 10)\n");
+    fprintf(stderr, "  -d dannulus : dannulus written to the config (default 15)\n");
+    fprintf(stderr, "  -B box      : box width written to the config (default 80)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  findstars ./RawObjectFiles/0000001.fits > config\n");
+    fprintf(stderr,
+	    "  findstars -f ./Final-MasterFlat.fits -b ./Final-MasterBias-subrect.fits -n 50 ./RawObjectFiles/0000001.fits > config\n\n");
+}
+
+// Read plane p (1 for a 2D image) of filename into a new width x height array
+double *read_plane(const char *filename, long p, long *width, long *height)
+{
+    fitsfile *fptr;
+    int status = 0, naxis;
+    long naxes[3] = { 1, 1, 1 }, fpixel[3] = { 1, 1, 1 };
+    double *pix;
+
+    fits_open_file(&fptr, filename, READONLY, &status);
+    fits_get_img_dim(fptr, &naxis, &status);
+    fits_get_img_size(fptr, 3, naxes, &status);
+    if (status) {
+	fits_report_error(stderr, status);
+	bail("Unable to open %s\n", filename);
+    }
+    if (naxis < 2 || p < 1 || p > naxes[2])
+	bail("%s has no plane %ld\n", filename, p);
+
+    pix = (double *) malloc(naxes[0] * naxes[1] * sizeof(double));
+    if (pix == NULL)
+	bail("Memory allocation error\n");
+    fpixel[2] = p;
+    if (fits_read_pix(fptr, TDOUBLE, fpixel, naxes[0] * naxes[1], NULL,
+		      pix, NULL, &status)) {
+	fits_report_error(stderr, status);
+	bail("Failed to read plane %ld of %s\n", p, filename);
+    }
+    fits_close_file(fptr, &status);
+
+    *width = naxes[0];
+    *height = naxes[1];
+    return pix;
+}
+
+int compare_doubles(const void *X, const void *Y)
+{
+    double x = *((double *) X);
+    double y = *((double *) Y);
+
+    return x > y ? 1 : (x < y ? -1 : 0);
+}
+
+// Median of n values, reorders the array
+double median(double *v, long n)
+{
+    qsort(v, n, sizeof(double), compare_doubles);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+//
+// Estimate the background and noise of each CELL x CELL cell. bg and sig are
+// gx x gy arrays, sigma comes from the median absolute deviation so the stars
+// in a cell do not inflate it.
+//
+void background_mesh(const double *pix, long width, long height, int gx,
+		     int gy, double *bg, double *sig)
+{
+    double *v = (double *) malloc(CELL * CELL * sizeof(double));
+    long x, y, n;
+    int cx, cy;
+
+    if (v == NULL)
+	bail("Memory allocation error\n");
+    for (cy = 0; cy < gy; cy++) {
+	for (cx = 0; cx < gx; cx++) {
+	    n = 0;
+	    for (y = cy * CELL; y < (cy + 1) * CELL && y < height; y++)
+		for (x = cx * CELL; x < (cx + 1) * CELL && x < width; x++)
+		    v[n++] = pix[y * width + x];
+	    bg[cy * gx + cx] = median(v, n);
+	    for (x = 0; x < n; x++)
+		v[x] = fabs(v[x] - bg[cy * gx + cx]);
+	    sig[cy * gx + cx] = 1.4826 * median(v, n);
+	}
+    }
+    free(v);
+}
+
+// Bilinear interpolation of a mesh value at pixel x, y
+double mesh_value(const double *mesh, int gx, int gy, long x, long y)
+{
+    double fx = (x + 0.5) / CELL - 0.5, fy = (y + 0.5) / CELL - 0.5;
+    int x0, y0, x1, y1;
+
+    if (fx < 0)
+	fx = 0;
+    if (fy < 0)
+	fy = 0;
+    if (fx > gx - 1)
+	fx = gx - 1;
+    if (fy > gy - 1)
+	fy = gy - 1;
+    x0 = fx;
+    y0 = fy;
+    x1 = x0 + 1 < gx ? x0 + 1 : x0;
+    y1 = y0 + 1 < gy ? y0 + 1 : y0;
+    fx -= x0;
+    fy -= y0;
+    return (1 - fy) * ((1 - fx) * mesh[y0 * gx + x0] +
+		       fx * mesh[y0 * gx + x1]) +
+	fy * ((1 - fx) * mesh[y1 * gx + x0] + fx * mesh[y1 * gx + x1]);
+}
+
+// Union find root with path halving
+long find_root(long *parent, long l)
+{
+    while (parent[l] != l) {
+	parent[l] = parent[parent[l]];
+	l = parent[l];
+    }
+    return l;
+}
+
+int compare_flux(const void *X, const void *Y)
+{
+    const struct component *x = X, *y = Y;
+
+    return x->sum < y->sum ? 1 : (x->sum > y->sum ? -1 : 0);
+}
+
+//
+// Label the pixels above the detection level into 8-connected components.
+// Provisional labels from the row above and the left neighbour are merged with
+// union find, then the component sums are folded onto the root labels.
+// Returns the number of components, stored in *comps.
+//
+long find_components(const double *pix, long width, long height,
+		     const double *bg, const double *sig, int gx, int gy,
+		     struct component **comps)
+{
+    long *label, *parent, nlabels = 1, maxlabels = 1024, x, y, l, n, r;
+    long nb[4];
+    int k;
+    double b, s, v;
+    struct component *c, *out;
+
+    label = (long *) calloc(width * height, sizeof(long));
+    parent = (long *) malloc(maxlabels * sizeof(long));
+    c = (struct component *) calloc(maxlabels, sizeof(struct component));
+    if (label == NULL || parent == NULL || c == NULL)
+	bail("Memory allocation error\n");
+
+    for (y = 0; y < height; y++) {
+	for (x = 0; x < width; x++) {
+	    b = mesh_value(bg, gx, gy, x, y);
+	    s = mesh_value(sig, gx, gy, x, y);
+	    v = pix[y * width + x] - b;
+	    if (v <= nsigma * s)
+		continue;
+
+	    // Neighbours already labelled: W, NW, N, NE
+	    nb[0] = x > 0 ? label[y * width + x - 1] : 0;
+	    nb[1] = x > 0 && y > 0 ? label[(y - 1) * width + x - 1] : 0;
+	    nb[2] = y > 0 ? label[(y - 1) * width + x] : 0;
+	    nb[3] = x < width - 1
+		&& y > 0 ? label[(y - 1) * width + x + 1] : 0;
+	    l = 0;
+	    for (k = 0; k < 4; k++) {
+		if (nb[k] == 0)
+		    continue;
+		r = find_root(parent, nb[k]);
+		if (l == 0)
+		    l = r;
+		else if (r != l) {	// two components meet, merge them
+		    if (r < l) {
+			parent[l] = r;
+			l = r;
+		    } else
+			parent[r] = l;
+		}
+	    }
+	    if (l == 0) {	// a new component
+		if (nlabels == maxlabels) {
+		    maxlabels *= 2;
+		    parent = (long *) realloc(parent, maxlabels * sizeof(long));
+		    c = (struct component *) realloc(c, maxlabels *
+						     sizeof(struct
+							    component));
+		    if (parent == NULL || c == NULL)
+			bail("Memory allocation error\n");
+		    memset(c + nlabels, 0,
+			   (maxlabels - nlabels) * sizeof(struct component));
+		}
+		l = nlabels++;
+		parent[l] = l;
+	    }
+	    label[y * width + x] = l;
+	    c[l].npix++;
+	    c[l].sum += v;
+	    c[l].sx += v * x;
+	    c[l].sy += v * y;
+	    if (v > c[l].peak) {
+		c[l].peak = v;
+		c[l].bg = b;
+	    }
+	}
+    }
+
+    // Fold every provisional label onto its root
+    for (l = nlabels - 1; l > 0; l--) {
+	r = find_root(parent, l);
+	if (r == l)
+	    continue;
+	c[r].npix += c[l].npix;
+	c[r].sum += c[l].sum;
+	c[r].sx += c[l].sx;
+	c[r].sy += c[l].sy;
+	if (c[l].peak > c[r].peak) {
+	    c[r].peak = c[l].peak;
+	    c[r].bg = c[l].bg;
+	}
+	c[l].npix = 0;
+    }
+
+    out = (struct component *) malloc(nlabels * sizeof(struct component));
+    if (out == NULL)
+	bail("Memory allocation error\n");
+    for (n = 0, l = 1; l < nlabels; l++)
+	if (c[l].npix >= minpix)
+	    out[n++] = c[l];
+    qsort(out, n, sizeof(struct component), compare_flux);
+
+    free(label);
+    free(parent);
+    free(c);
+    *comps = out;
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, gx, gy;
+    char *flatfile = NULL, *biasfile = NULL;
+    long width, height, fw, fh, bw, bh, n, s, written = 0, offframe = 0;
+    double *pix, *flat, *bias, *bg, *sig, x, y;
+    struct component *comps;
+
+    while ((opt = getopt(argc, argv, "p:f:b:s:m:n:r:a:d:B:h")) != -1) {
+	switch (opt) {
+	case 'p':
+	    plane = atol(optarg);
+	    break;
+	case 'f':
+	    flatfile = optarg;
+	    break;
+	case 'b':
+	    biasfile = optarg;
+	    break;
+	case 's':
+	    nsigma = atof(optarg);
+	    break;
+	case 'm':
+	    minpix = atoi(optarg);
+	    break;
+	case 'n':
+	    maxstars = atoi(optarg);
+	    break;
+	case 'r':
+	    radius = atof(optarg);
+	    break;
+	case 'a':
+	    annulusval = atof(optarg);
+	    break;
+	case 'd':
+	    dannulusval = atof(optarg);
+	    break;
+	case 'B':
+	    boxdims = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	    exit(0);
+	}
+    }
+    if (argc - optind != 1 || (flatfile == NULL) != (biasfile == NULL)) {
+	usage();
+	exit(0);
+    }
+    if (nsigma <= 0 || minpix < 1 || maxstars < 0 || boxdims < 8)
+	bail("Invalid parameters\n");
+    if (radius + annulusval + dannulusval > boxdims / 2)
+	bail("Box of %d is too small for radius %.0f, annulus %.0f and dannulus %.0f\n",
+	     boxdims, radius, annulusval, dannulusval);
+
+    pix = read_plane(argv[optind], plane, &width, &height);
+    if (flatfile != NULL) {	// Clean the plane with the master files
+	flat = read_plane(flatfile, 1, &fw, &fh);
+	bias = read_plane(biasfile, 1, &bw, &bh);
+	if (fw != width || fh != height || bw != width || bh != height)
+	    bail("Error: input images don't have same size\n");
+	for (n = 0; n < width * height; n++)
+	    pix[n] = (pix[n] - bias[n]) / flat[n];
+	free(flat);
+	free(bias);
+    }
+
+    gx = (width + CELL - 1) / CELL;
+    gy = (height + CELL - 1) / CELL;
+    bg = (double *) malloc(gx * gy * sizeof(double));
+    sig = (double *) malloc(gx * gy * sizeof(double));
+    if (bg == NULL || sig == NULL)
+	bail("Memory allocation error\n");
+    background_mesh(pix, width, height, gx, gy, bg, sig);
+    n = find_components(pix, width, height, bg, sig, gx, gy, &comps);
+
+    printf("! Stars found by findstars in %s plane %ld, %.1f sigma, %d pixels or more\n",
+	   argv[optind], plane, nsigma, minpix);
+    printf("! X Y Radius Annulus Dannulus boxwidth Threshold\n");
+    for (s = 0; s < n && (maxstars == 0 || written < maxstars); s++) {
+	// config positions are FITS pixels, which start at 1
+	x = floor(comps[s].sx / comps[s].sum + 0.5) + 1;
+	y = floor(comps[s].sy / comps[s].sum + 0.5) + 1;
+	if (x - boxdims / 2 < 1 || y - boxdims / 2 < 1
+	    || x + boxdims / 2 - 1 > width || y + boxdims / 2 - 1 > height) {
+	    offframe++;
+	    continue;
+	}
+	written++;
+	printf("%.0f %.0f %.0f %.0f %.0f %d %.0f ! Star details %ld flux %.0f\n",
+	       x, y, radius, annulusval, dannulusval, boxdims,
+	       ceil(comps[s].bg + comps[s].peak / 4), written, comps[s].sum);
+    }
+    fprintf(stderr, "%ld stars found, %ld written, %ld too close to the edge for a box of %d\n",
+	    n, written, offframe, boxdims);
+
+    free(pix);
+    free(bg);
+    free(sig);
+    free(comps);
+    exit(0);
+}
@@ -0,0 +1,446 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "fitsio.h"
+
+/*
+*      fitscompress: Tile compress, recompress or decompress FITS files on all cores.
+*
+*                 The same job as fpack and funpack, done with CFITSIO's tile compression
+*                 inside one process by a pool of threads, one file per thread, rather than
+*                 a process per file. name.fits is written as name.fits.fz, as fpack does,
+*                 and -d writes name.fz back as name, as funpack does. A .fz input that is
+*                 not being decompressed is recompressed in place with the new settings,
+*                 which is how an archive is moved to a different quantisation.
+*
+*                 Each output is written under a temporary name and renamed when complete,
+*                 so an interrupted run never leaves a partial file under the real name.
+*                 A line is printed per file and the throughput of the run at the end.
+*
+*                 CFITSIO must be built with --enable-reentrant for more than one thread,
+*                 a library built without it is used from a single thread.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+#define BUFSIZE 2056
+
+enum { MODE_COMPRESS, MODE_RECOMPRESS, MODE_DECOMPRESS };
+
+struct settings {
+    int mode;
+    int type;			// RICE_1, GZIP_1, ...
+    int setquantize;		// quantize level given, otherwise the CFITSIO default
+    float quantize;		// quantize level of floating point images, 0 lossless
+    int method;			// SUBTRACTIVE_DITHER_1, SUBTRACTIVE_DITHER_2 or NO_DITHER
+    long tile[2];		// tile width and height, 0 for the CFITSIO default of rows
+    const char *outdir;		// NULL writes beside the input
+    int delete;			// remove the input once its output is written
+    int quiet;
+};
+
+static struct settings opts = {
+    MODE_COMPRESS, RICE_1, 0, 0, SUBTRACTIVE_DITHER_1, {0, 0}, NULL, 0, 0
+};
+
+static char **inputs;
+static long ninputs;
+
+// Shared by the workers, protected by lock
+static long nextinput, failed;
+static double bytesin, bytesout;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: fitscompress [options] file|dir...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -d          : decompress name.fz to name (default compress name to name.fz)\n");
+    fprintf(stderr, "  -r          : recompress the .fz files of a directory in place\n");
+    fprintf(stderr, "  -z type     : rice, gzip, gzip2, hcompress or plio (default rice)\n");
+    fprintf(stderr, "  -q level    : quantize level of floating point images, 0 for lossless\n");
+    fprintf(stderr, "                gzip (default the CFITSIO level, 4)\n");
+    fprintf(stderr, "  -Q method   : dither 1, dither 2 or none before quantizing (default 1)\n");
+    fprintf(stderr, "  -t WxH      : tile size (default one row per tile)\n");
+    fprintf(stderr, "  -o dir      : write the outputs to dir (default beside the inputs)\n");
+    fprintf(stderr, "  -D          : delete each input once its output is written\n");
+    fprintf(stderr, "  -j threads  : files processed at once (default one per core)\n");
+    fprintf(stderr, "  -s          : silent, print only the totals\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  A directory stands for its .fits files, its .fz files with -d or -r.\n");
+    fprintf(stderr, "  A .fz file given by name is recompressed in place unless -d is given.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  fitscompress -D /mnt/storage1/AstronomyData/ExpA/dataset1\n");
+    fprintf(stderr, "  fitscompress -r -q 8 -Q 2 /mnt/storage1/AstronomyData/compressedRAW\n");
+    fprintf(stderr, "  fitscompress -d -o ../Exp star1-bf00001.fits.fz\n\n");
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static void add_input(const char *path)
+{
+    static long allocated;
+
+    if (ninputs == allocated) {
+	allocated = allocated ? 2 * allocated : 256;
+	inputs = (char **) realloc(inputs, allocated * sizeof(char *));
+	if (inputs == NULL)
+	    bail("Memory allocation error\n");
+    }
+    if ((inputs[ninputs++] = strdup(path)) == NULL)
+	bail("Memory allocation error\n");
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Add path, or the files of it the mode works on when it is a directory
+static void add_inputs(const char *path)
+{
+    struct stat sb;
+    struct dirent *e;
+    DIR *d;
+    char file[BUFSIZE];
+    const char *suffix = opts.mode == MODE_COMPRESS ? ".fits" : ".fz";
+    long first = ninputs;
+
+    if (stat(path, &sb) != 0)
+	bail("Unable to find %s\n", path);
+    if (!S_ISDIR(sb.st_mode)) {
+	add_input(path);
+	return;
+    }
+    if ((d = opendir(path)) == NULL)
+	bail("Unable to read directory %s\n", path);
+    while ((e = readdir(d)) != NULL) {
+	if (!has_suffix(e->d_name, suffix))
+	    continue;
+	snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+	add_input(file);
+    }
+    closedir(d);
+    qsort(inputs + first, ninputs - first, sizeof(char *), compare_names);
+}
+
+//
+// Work out where the output of path goes. Returns the mode for this file,
+// which follows its name: .fz is decompressed with -d, otherwise recompressed.
+//
+static int output_name(const char *path, char *out, size_t len)
+{
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    int mode = MODE_COMPRESS;
+
+    if (has_suffix(path, ".fz"))
+	mode = opts.mode == MODE_DECOMPRESS ? MODE_DECOMPRESS : MODE_RECOMPRESS;
+    if (opts.outdir != NULL)
+	snprintf(out, len, "%s/%s", opts.outdir, name);
+    else
+	snprintf(out, len, "%s", path);
+    if (mode == MODE_COMPRESS)
+	strncat(out, ".fz", len - strlen(out) - 1);
+    else if (mode == MODE_DECOMPRESS)
+	out[strlen(out) - 3] = '\0';
+    return mode;
+}
+
+static void set_compression(fitsfile * out, int *status)
+{
+    fits_set_compression_type(out, opts.type, status);
+    if (opts.setquantize)
+	fits_set_quantize_level(out, opts.quantize, status);
+    fits_set_quantize_method(out, opts.method, status);
+    if (opts.tile[0] > 0)
+	fits_set_tile_dim(out, 2, opts.tile, status);
+}
+
+//
+// Copy every HDU of in to out, compressing or decompressing the images as mode
+// asks. An image that is recompressed is decompressed into memory first, so it
+// is compressed from its pixels rather than from the old tiles.
+//
+static void copy_hdus(fitsfile * in, fitsfile * out, int mode, int *status)
+{
+    fitsfile *mem;
+    int hdu, hdutype, naxis, compressed, nhdus, memstatus;
+
+    fits_get_num_hdus(in, &nhdus, status);
+    for (hdu = 1; hdu <= nhdus && !*status; hdu++) {
+	fits_movabs_hdu(in, hdu, &hdutype, status);
+	naxis = 0;
+	if (hdutype == IMAGE_HDU)
+	    fits_get_img_dim(in, &naxis, status);
+	compressed = fits_is_compressed_image(in, status);
+	if (*status)
+	    break;
+
+	if (mode == MODE_DECOMPRESS) {
+	    // as funpack, the empty primary fpack adds goes when its image comes back
+	    if (hdu == 1 && naxis == 0 && nhdus == 2) {
+		fits_movabs_hdu(in, 2, &hdutype, status);
+		if (fits_is_compressed_image(in, status))
+		    continue;
+		fits_movabs_hdu(in, 1, &hdutype, status);
+	    }
+	    if (compressed)
+		fits_img_decompress(in, out, status);
+	    else
+		fits_copy_hdu(in, out, 0, status);
+	} else if (compressed) {
+	    mem = NULL;
+	    fits_create_file(&mem, "mem://", status);
+	    fits_img_decompress(in, mem, status);
+	    fits_img_compress(mem, out, status);
+	    memstatus = 0;
+	    if (mem != NULL)
+		fits_close_file(mem, &memstatus);
+	} else if (hdutype == IMAGE_HDU && naxis > 0)
+	    fits_img_compress(in, out, status);
+	else
+	    fits_copy_hdu(in, out, 0, status);
+    }
+}
+
+//
+// Compress, recompress or decompress path. Returns 0 on success, otherwise non
+// zero with the reason in errmsg.
+//
+static int process_file(const char *path, double *sizeout, char *errmsg,
+			size_t errlen)
+{
+    fitsfile *in = NULL, *out = NULL;
+    char outpath[BUFSIZE], tmppath[BUFSIZE + 16], fitserr[FLEN_ERRMSG];
+    struct stat sb;
+    int status = 0, s = 0, mode;
+
+    mode = output_name(path, outpath, sizeof(outpath));
+    if (opts.mode == MODE_DECOMPRESS && mode != MODE_DECOMPRESS) {
+	snprintf(errmsg, errlen, "%s: not a .fz file, nothing to decompress",
+		 path);
+	return 1;
+    }
+    snprintf(tmppath, sizeof(tmppath), "!%s.tmp%ld", outpath,
+	     (long) getpid());	// ! overwrites a stale one
+
+    fits_open_file(&in, path, READONLY, &status);
+    fits_create_file(&out, tmppath, &status);
+    if (mode != MODE_DECOMPRESS)
+	set_compression(out, &status);
+    copy_hdus(in, out, mode, &status);
+    if (out != NULL)
+	fits_close_file(out, status ? &s : &status);
+    s = 0;
+    if (in != NULL)
+	fits_close_file(in, &s);
+
+    if (status) {
+	fits_get_errstatus(status, fitserr);
+	snprintf(errmsg, errlen, "%s: %s", path, fitserr);
+	unlink(tmppath + 1);
+	return status;
+    }
+    if (rename(tmppath + 1, outpath) != 0) {
+	snprintf(errmsg, errlen, "%s: unable to rename %s to %s", path,
+		 tmppath + 1, outpath);
+	unlink(tmppath + 1);
+	return 1;
+    }
+    *sizeout = stat(outpath, &sb) == 0 ? (double) sb.st_size : 0;
+    if (opts.delete && strcmp(path, outpath) != 0 && unlink(path) != 0) {
+	snprintf(errmsg, errlen, "%s: written but unable to delete it", path);
+	return 1;
+    }
+    return 0;
+}
+
+// Worker: process the next input until none are left
+static void *worker(void *arg)
+{
+    char errmsg[BUFSIZE];
+    double start, sizein, sizeout, took;
+    struct stat sb;
+    long i;
+
+    (void) arg;
+    for (;;) {
+	pthread_mutex_lock(&lock);
+	i = nextinput < ninputs ? nextinput++ : -1;
+	pthread_mutex_unlock(&lock);
+	if (i < 0)
+	    break;
+
+	start = now();		// before a recompression replaces the input
+	sizein = stat(inputs[i], &sb) == 0 ? (double) sb.st_size : 0;
+	sizeout = 0;
+	errmsg[0] = '\0';
+	if (process_file(inputs[i], &sizeout, errmsg, sizeof(errmsg))) {
+	    pthread_mutex_lock(&lock);
+	    failed++;
+	    fprintf(stderr, "Error: %s\n", errmsg);
+	    pthread_mutex_unlock(&lock);
+	    continue;
+	}
+	took = now() - start;
+
+	pthread_mutex_lock(&lock);
+	bytesin += sizein;
+	bytesout += sizeout;
+	if (!opts.quiet)
+	    printf("%s: %.2f MB -> %.2f MB (%.2f:1) in %.2fs, %.1f MB/s\n",
+		   inputs[i], sizein / 1e6, sizeout / 1e6,
+		   sizeout > 0 ? sizein / sizeout : 0, took,
+		   took > 0 ? sizein / 1e6 / took : 0);
+	pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t *threads;
+    int nthreads = 0, c, t;
+    double start, took;
+    long i;
+
+    while ((c = getopt(argc, argv, "drz:q:Q:t:o:Dj:sh")) != -1) {
+	switch (c) {
+	case 'd':
+	    opts.mode = MODE_DECOMPRESS;
+	    break;
+	case 'r':
+	    opts.mode = MODE_RECOMPRESS;
+	    break;
+	case 'z':
+	    if (strcmp(optarg, "rice") == 0)
+		opts.type = RICE_1;
+	    else if (strcmp(optarg, "gzip") == 0)
+		opts.type = GZIP_1;
+	    else if (strcmp(optarg, "gzip2") == 0)
+		opts.type = GZIP_2;
+	    else if (strcmp(optarg, "hcompress") == 0)
+		opts.type = HCOMPRESS_1;
+	    else if (strcmp(optarg, "plio") == 0)
+		opts.type = PLIO_1;
+	    else
+		bail("Unknown compression %s\n", optarg);
+	    break;
+	case 'q':
+	    opts.quantize = atof(optarg);
+	    opts.setquantize = 1;
+	    break;
+	case 'Q':
+	    if (strcmp(optarg, "1") == 0)
+		opts.method = SUBTRACTIVE_DITHER_1;
+	    else if (strcmp(optarg, "2") == 0)
+		opts.method = SUBTRACTIVE_DITHER_2;
+	    else if (strcmp(optarg, "none") == 0)
+		opts.method = NO_DITHER;
+	    else
+		bail("Unknown quantize method %s\n", optarg);
+	    break;
+	case 't':
+	    if (sscanf(optarg, "%ldx%ld", &opts.tile[0], &opts.tile[1]) != 2
+		|| opts.tile[0] < 1 || opts.tile[1] < 1)
+		bail("Bad tile size %s, expected WxH\n", optarg);
+	    break;
+	case 'o':
+	    opts.outdir = optarg;
+	    break;
+	case 'D':
+	    opts.delete = 1;
+	    break;
+	case 'j':
+	    nthreads = atoi(optarg);
+	    break;
+	case 's':
+	    opts.quiet = 1;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind >= argc) {
+	usage();
+	return 1;
+    }
+
+    for (i = optind; i < argc; i++)
+	add_inputs(argv[i]);
+    if (ninputs == 0)
+	bail("No files to process\n");
+    if (opts.outdir != NULL && mkdir(opts.outdir, 0777) != 0
+	&& access(opts.outdir, W_OK) != 0)
+	bail("Unable to create %s\n", opts.outdir);
+
+    if (nthreads <= 0)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+	nthreads = 1;
+    if (nthreads > 1 && !fits_is_reentrant()) {
+	fprintf(stderr, "CFITSIO is not reentrant, processing one file at a time\n");
+	nthreads = 1;
+    }
+    if (nthreads > ninputs)
+	nthreads = ninputs;
+
+    start = now();
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    if (threads == NULL)
+	bail("Memory allocation error\n");
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&threads[t], NULL, worker, NULL) != 0)
+	    bail("Unable to start a thread\n");
+    for (t = 0; t < nthreads; t++)
+	pthread_join(threads[t], NULL);
+    free(threads);
+    took = now() - start;
+
+    printf("%ld files, %ld failed, %.2f MB -> %.2f MB (%.2f:1) in %.2fs on %d threads\n",
+	   ninputs - failed, failed, bytesin / 1e6, bytesout / 1e6,
+	   bytesout > 0 ? bytesin / bytesout : 0, took, nthreads);
+    printf("Throughput %.1f MB/s read, %.1f MB/s written\n",
+	   took > 0 ? bytesin / 1e6 / took : 0,
+	   took > 0 ? bytesout / 1e6 / took : 0);
+
+    for (i = 0; i < ninputs; i++)
+	free(inputs[i]);
+    free(inputs);
+    return failed > 0;
+}
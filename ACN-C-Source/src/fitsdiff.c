@@ -0,0 +1,356 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "fitsio.h"
+#include "fitsdiff.h"
+
+// Pixels compared at once by diff_block, a vector register's worth
+#ifdef __AVX__
+#define DIFF_LANES 4
+#else
+#define DIFF_LANES 2
+#endif
+
+/*
+*      fitsdiff: Compare two images or cubes of the same size pixel by pixel within absolute,
+*                relative and ULP tolerances, gathering the statistics of the differences.
+*
+*                 Both files are streamed through in blocks of pixels which run across row
+*                 and plane boundaries, so cubes of any depth are compared in a few large
+*                 reads. diff_block makes one branch free pass over each block, DIFF_LANES
+*                 pixels at a time in SIMD registers, counting the differing pixels and the
+*                 largest differences. Only a block holding differing pixels that still need
+*                 remembering, or a new largest difference, is passed over again.
+*
+*                 Pixels that are NaN in both files match, a NaN in only one is counted as
+*                 a differing pixel and a NaN mismatch. The RMS is over all pixels compared.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+// Map a double onto an unsigned integer in the same order, so the distance
+// between two mapped values is the number of doubles between them (-0 and +0
+// are one apart)
+static inline uint64_t ordered(double x)
+{
+    uint64_t u;
+
+    memcpy(&u, &x, sizeof(u));
+    return u ^ ((uint64_t) ((int64_t) u >> 63) | (1ULL << 63));
+}
+
+static inline uint64_t ulp_distance(double a, double b)
+{
+    uint64_t ua = ordered(a), ub = ordered(b);
+
+    return ua > ub ? ua - ub : ub - ua;
+}
+
+void diff_init(struct diff_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->maxindex = -1;
+}
+
+//
+// Whether a and b match within the tolerances of opt
+//
+int diff_within(double a, double b, const struct diff_options *opt)
+{
+    double ad = fabs(a - b);
+
+    if (a == b || (isnan(a) && isnan(b)))
+	return 1;
+    if (isnan(a) || isnan(b))
+	return 0;
+    return (opt->abs >= 0 && ad <= opt->abs)
+	|| (opt->rel >= 0 && ad <= opt->rel * fmax(fabs(a), fabs(b)))
+	|| (opt->ulp >= 0 && ulp_distance(a, b) <= (uint64_t) opt->ulp);
+}
+
+// DIFF_LANES pixels as one vector, with the GCC/clang vector extensions. The
+// comparisons give masks of all ones or zeros per lane.
+typedef double vdouble __attribute__ ((vector_size(DIFF_LANES * 8)));
+typedef long long vlong __attribute__ ((vector_size(DIFF_LANES * 8)));
+typedef unsigned long long vulong __attribute__ ((vector_size(DIFF_LANES * 8)));
+
+// Per lane sums and maxima of diff_block
+struct lanes {
+    vdouble maxabs, maxrel, sumsq;
+    vulong maxulp;
+    vlong bad, nanbad;		// counted down by the masks
+};
+
+// Lanes of a where the mask m is set and of b elsewhere
+#define SELECT_D(m, a, b) ((vdouble) (((vlong) (a) & (m)) | ((vlong) (b) & ~(m))))
+#define SELECT_U(m, a, b) (((a) & (vulong) (m)) | ((b) & ~(vulong) (m)))
+
+//
+// Compare DIFF_LANES pixels into the lanes without branches. NaN compares
+// false so a NaN difference adds nothing to the maxima and the finite mask
+// keeps it out of the sums.
+//
+static inline void diff_lanes(const double *a, const double *b,
+			      double abstol, double reltol,
+			      unsigned long long ulptol, long long useulp,
+			      struct lanes *l)
+{
+    const long long sign = (long long) (1ULL << 63);
+    vdouble x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    vdouble diff = x - y;
+    vdouble ad = (vdouble) ((vlong) diff & ~sign);
+    vdouble ax = (vdouble) ((vlong) x & ~sign);
+    vdouble ay = (vdouble) ((vlong) y & ~sign);
+    vdouble scale = SELECT_D(ax > ay, ax, ay);
+    vlong xnan = x != x, ynan = y != y, mismatch = xnan ^ ynan;
+    vlong same = (x == y) | (xnan & ynan);
+    vlong finite = ad < INFINITY;
+    vulong ox = (vulong) x ^ (vulong) (((vlong) x >> 63) | sign);
+    vulong oy = (vulong) y ^ (vulong) (((vlong) y >> 63) | sign);
+    vulong ulp = SELECT_U(ox > oy, ox - oy, oy - ox)
+	& (unsigned long long) -useulp;
+    vlong within = (ad <= abstol) | (ad <= reltol * scale)
+	| (-useulp & (ulp <= ulptol));
+    vdouble rel = ad / scale;
+
+    l->bad += ~same & (mismatch | ~within);
+    l->nanbad += mismatch;
+    l->maxabs = SELECT_D((ad > l->maxabs) & finite, ad, l->maxabs);
+    l->maxrel = SELECT_D(rel > l->maxrel, rel, l->maxrel);
+    l->maxulp = SELECT_U(~(xnan | ynan) & (ulp > l->maxulp), ulp,
+			 l->maxulp);
+    l->sumsq += (vdouble) ((vlong) (diff * diff) & finite);
+}
+
+//
+// Compare n pixels, the first being pixel number first, adding them to st. If
+// d is not NULL a - b is stored in it.
+//
+void diff_block(const double *a, const double *b, long n, long long first,
+		const struct diff_options *opt, struct diff_stats *st,
+		double *d)
+{
+    double abstol = opt->abs >= 0 ? opt->abs : -1;
+    double reltol = opt->rel >= 0 ? opt->rel : -1;
+    unsigned long long ulptol = opt->ulp >= 0 ? opt->ulp : 0;
+    long long useulp = opt->ulp >= 0;
+    double ta[DIFF_LANES] = { 0 }, tb[DIFF_LANES] = { 0 };
+    struct lanes l;
+    long long nbad;
+    long i, j;
+
+    memset(&l, 0, sizeof(l));
+    // Constant useulp so the ULP work is compiled out when it is not wanted
+    if (useulp)
+	for (i = 0; i + DIFF_LANES <= n; i += DIFF_LANES)
+	    diff_lanes(a + i, b + i, abstol, reltol, ulptol, 1, &l);
+    else
+	for (i = 0; i + DIFF_LANES <= n; i += DIFF_LANES)
+	    diff_lanes(a + i, b + i, abstol, reltol, 0, 0, &l);
+    if (i < n) {		// the tail, padded with equal pixels
+	memcpy(ta, a + i, (n - i) * sizeof(double));
+	memcpy(tb, b + i, (n - i) * sizeof(double));
+	diff_lanes(ta, tb, abstol, reltol, ulptol, useulp, &l);
+    }
+    if (d != NULL)
+	for (i = 0; i < n; i++)
+	    d[i] = a[i] - b[i];
+
+    for (j = 1; j < DIFF_LANES; j++) {
+	l.bad[0] += l.bad[j];
+	l.nanbad[0] += l.nanbad[j];
+	l.sumsq[0] += l.sumsq[j];
+	l.maxabs[0] = fmax(l.maxabs[0], l.maxabs[j]);
+	l.maxrel[0] = fmax(l.maxrel[0], l.maxrel[j]);
+	l.maxulp[0] =
+	    l.maxulp[j] > l.maxulp[0] ? l.maxulp[j] : l.maxulp[0];
+    }
+    l.bad[0] = -l.bad[0];
+    l.nanbad[0] = -l.nanbad[0];
+    st->checked += n;
+    st->differ += l.bad[0];
+    st->nanmismatch += l.nanbad[0];
+    st->sumsq += l.sumsq[0];
+    if (l.maxrel[0] > st->maxrel)
+	st->maxrel = l.maxrel[0];
+    if (l.maxulp[0] > st->maxulp)
+	st->maxulp = l.maxulp[0];
+    st->ulpmeasured |= useulp;
+
+    // Find where the new largest difference is
+    if (l.maxabs[0] > st->maxabs) {
+	st->maxabs = l.maxabs[0];
+	for (i = 0; i < n && fabs(a[i] - b[i]) != l.maxabs[0]; i++);
+	st->maxindex = first + i;
+    }
+    // Remember the first differing pixels
+    nbad = l.bad[0];
+    for (i = 0; i < n && nbad > 0 && st->nlocations < opt->nlocations
+	 && st->nlocations < DIFF_MAXLOCATIONS; i++) {
+	if (diff_within(a[i], b[i], opt))
+	    continue;
+	st->locations[st->nlocations].index = first + i;
+	st->locations[st->nlocations].a = a[i];
+	st->locations[st->nlocations].b = b[i];
+	st->nlocations++;
+	nbad--;
+    }
+}
+
+//
+// Compare afile with bfile into st. Returns 0 when the files were compared,
+// otherwise non zero with the reason in errmsg.
+//
+int fitsdiff_files(const char *afile, const char *bfile,
+		   const struct diff_options *opt, struct diff_stats *st,
+		   char *errmsg, size_t errlen)
+{
+    fitsfile *afptr = NULL, *bfptr = NULL, *dfptr = NULL;
+    int status = 0, bnaxis, k;
+    long bnaxes[3] = { 1, 1, 1 }, fpixel[3], block;
+    long long npixels, first, n;
+    double *apix = NULL, *bpix = NULL, *dpix = NULL;
+    char fitserr[FLEN_ERRMSG], path[FLEN_FILENAME];
+
+    diff_init(st);
+    st->naxes[0] = st->naxes[1] = st->naxes[2] = 1;
+    errmsg[0] = '\0';
+
+    fits_open_file(&afptr, afile, READONLY, &status);
+    fits_get_img_dim(afptr, &st->naxis, &status);
+    fits_get_img_size(afptr, 3, st->naxes, &status);
+    if (status) {
+	fits_get_errstatus(status, fitserr);
+	snprintf(errmsg, errlen, "%s: %s", afile, fitserr);
+	goto done;
+    }
+    fits_open_file(&bfptr, bfile, READONLY, &status);
+    fits_get_img_dim(bfptr, &bnaxis, &status);
+    fits_get_img_size(bfptr, 3, bnaxes, &status);
+    if (status) {
+	fits_get_errstatus(status, fitserr);
+	snprintf(errmsg, errlen, "%s: %s", bfile, fitserr);
+	goto done;
+    }
+    if (st->naxis > 3 || bnaxis > 3) {
+	snprintf(errmsg, errlen,
+		 "images with > 3 dimensions are not supported");
+	status = -1;
+	goto done;
+    }
+    if (st->naxes[0] != bnaxes[0] || st->naxes[1] != bnaxes[1]
+	|| st->naxes[2] != bnaxes[2]) {
+	snprintf(errmsg, errlen,
+		 "sizes differ, %ld x %ld x %ld and %ld x %ld x %ld",
+		 st->naxes[0], st->naxes[1], st->naxes[2], bnaxes[0],
+		 bnaxes[1], bnaxes[2]);
+	status = -1;
+	goto done;
+    }
+
+    if (opt->diffimage != NULL) {
+	snprintf(path, sizeof(path), "!%s", opt->diffimage);	// ! overwrites
+	fits_create_file(&dfptr, path, &status);
+	fits_create_img(dfptr, DOUBLE_IMG, st->naxis, st->naxes, &status);
+	if (status) {
+	    fits_get_errstatus(status, fitserr);
+	    snprintf(errmsg, errlen, "%s: %s", opt->diffimage, fitserr);
+	    goto done;
+	}
+    }
+
+    npixels = (long long) st->naxes[0] * st->naxes[1] * st->naxes[2];
+    block = opt->block > 0 ? opt->block : DIFF_BLOCK;
+    if (block > npixels)
+	block = npixels;
+    apix = (double *) malloc(block * sizeof(double));
+    bpix = (double *) malloc(block * sizeof(double));
+    if (dfptr != NULL)
+	dpix = (double *) malloc(block * sizeof(double));
+    if (apix == NULL || bpix == NULL || (dfptr != NULL && dpix == NULL)) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	status = -1;
+	goto done;
+    }
+
+    for (first = 0; first < npixels; first += n) {
+	n = npixels - first < block ? npixels - first : block;
+	fpixel[0] = first % st->naxes[0] + 1;
+	fpixel[1] = first / st->naxes[0] % st->naxes[1] + 1;
+	fpixel[2] = first / ((long long) st->naxes[0] * st->naxes[1]) + 1;
+	fits_read_pix(afptr, TDOUBLE, fpixel, n, NULL, apix, NULL, &status);
+	fits_read_pix(bfptr, TDOUBLE, fpixel, n, NULL, bpix, NULL, &status);
+	if (status) {
+	    fits_get_errstatus(status, fitserr);
+	    snprintf(errmsg, errlen, "reading pixel %lld: %s", first + 1,
+		     fitserr);
+	    goto done;
+	}
+	diff_block(apix, bpix, n, first, opt, st, dpix);
+	if (dfptr != NULL
+	    && fits_write_pix(dfptr, TDOUBLE, fpixel, n, dpix, &status)) {
+	    fits_get_errstatus(status, fitserr);
+	    snprintf(errmsg, errlen, "%s: %s", opt->diffimage, fitserr);
+	    goto done;
+	}
+    }
+
+  done:
+    k = 0;
+    if (dfptr != NULL)
+	fits_close_file(dfptr, &k);
+    k = 0;
+    if (bfptr != NULL)
+	fits_close_file(bfptr, &k);
+    k = 0;
+    if (afptr != NULL)
+	fits_close_file(afptr, &k);
+    free(apix);
+    free(bpix);
+    free(dpix);
+    return status;
+}
+
+// Print pixel number index as plane, row and column
+static void print_location(FILE * out, const struct diff_stats *st,
+			   long long index)
+{
+    fprintf(out, "plane %lld, r %lld, c %lld",
+	    index / ((long long) st->naxes[0] * st->naxes[1]) + 1,
+	    index / st->naxes[0] % st->naxes[1] + 1,
+	    index % st->naxes[0] + 1);
+}
+
+//
+// Print the summary statistics and up to nlocations differing pixels
+//
+void diff_report(FILE * out, const struct diff_stats *st, long nlocations)
+{
+    long i;
+
+    fprintf(out,
+	    "The number of items checked %lld - differences = %lld (%lld NaN mismatches)\n",
+	    st->checked, st->differ, st->nanmismatch);
+    fprintf(out, "Max abs diff = %.6g", st->maxabs);
+    if (st->maxindex >= 0) {
+	fprintf(out, " at ");
+	print_location(out, st, st->maxindex);
+    }
+    fprintf(out, "\nRMS diff = %.6g, max rel diff = %.6g",
+	    st->checked ? sqrt(st->sumsq / st->checked) : 0, st->maxrel);
+    if (st->ulpmeasured)
+	fprintf(out, ", max ulp = %llu", st->maxulp);
+    fprintf(out, "\n");
+    for (i = 0; i < st->nlocations && i < nlocations; i++) {
+	fprintf(out, "diff = %f   ",
+		st->locations[i].a - st->locations[i].b);
+	print_location(out, st, st->locations[i].index);
+	fprintf(out, ", %*.*f, %*.*f\n", 11, 14, st->locations[i].a, 11,
+		14, st->locations[i].b);
+    }
+}
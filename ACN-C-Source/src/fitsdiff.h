@@ -0,0 +1,54 @@
+#ifndef FITSDIFF_H
+#define FITSDIFF_H
+
+#include <stdio.h>
+
+/*
+*      fitsdiff.h: Pixel by pixel comparison of two FITS images or cubes, shared by compare
+*                  and verifydir. Pixels are numbered from 0 in file order, plane major.
+*/
+
+#define DIFF_MAXLOCATIONS 1000	// most differing pixels remembered
+#define DIFF_BLOCK (1L << 20)	// pixels read from each file at a time
+
+// A pixel matches when it is equal or within any of the enabled tolerances,
+// a negative tolerance is disabled
+struct diff_options {
+    double abs;			// |a - b|
+    double rel;			// |a - b| / max(|a|, |b|)
+    long long ulp;		// representable doubles between a and b
+    long nlocations;		// differing pixels to remember
+    long block;			// pixels read at a time, 0 for DIFF_BLOCK
+    const char *diffimage;	// write a - b to this file, NULL for none
+};
+
+struct diff_location {
+    long long index;
+    double a, b;
+};
+
+struct diff_stats {
+    int naxis;
+    long naxes[3];
+    long long checked;		// pixels compared
+    long long differ;		// pixels outside the tolerances
+    long long nanmismatch;	// of which one side is NaN and the other not
+    double maxabs, maxrel, sumsq;	// over pixels with a finite difference
+    long long maxindex;		// pixel with the largest |a - b|, -1 if none differ
+    unsigned long long maxulp;	// only measured with an ULP tolerance
+    int ulpmeasured;
+    long nlocations;
+    struct diff_location locations[DIFF_MAXLOCATIONS];
+};
+
+void diff_init(struct diff_stats *st);
+void diff_block(const double *a, const double *b, long n, long long first,
+		const struct diff_options *opt, struct diff_stats *st,
+		double *d);
+int diff_within(double a, double b, const struct diff_options *opt);
+int fitsdiff_files(const char *afile, const char *bfile,
+		   const struct diff_options *opt, struct diff_stats *st,
+		   char *errmsg, size_t errlen);
+void diff_report(FILE * out, const struct diff_stats *st, long nlocations);
+
+#endif
@@ -0,0 +1,396 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "fitshdr.h"
+
+/*
+*      fitshdr: Read the keywords of a FITS file from its header blocks only.
+*
+*                 The primary header is read block by block up to its END card. When the
+*                 primary HDU has no data, as in fpack'ed .fz files and many cameras' files,
+*                 the header of the first extension which follows it is read too and its
+*                 keywords take precedence. A tile compressed image extension (ZIMAGE = T)
+*                 describes the image in ZNAXISn and ZBITPIX, which are returned for NAXISn
+*                 and BITPIX so the image size reads the same for compressed files.
+*
+*                 Only plain files are read, no compression of the whole file (.gz) and no
+*                 CFITSIO extended file names.
+*
+*                 fitshdr_check_images reads the headers of a set of input files on one thread
+*                 per core and checks each describes a usable image: a known BITPIX, 2 to
+*                 maxnaxis axes, a known tile compression and a file long enough to hold the
+*                 data, so a truncated copy is caught without reading it. Optionally every
+*                 image must have the same width and height. gmb, gmf, cleanobjectfile and
+*                 acn-aphot use it to fail in seconds on a bad input instead of part way
+*                 through the processing.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+// Copy the keyword of card to key, without trailing spaces
+static void card_key(const char *card, char *key)
+{
+    int n;
+
+    memcpy(key, card, 8);
+    for (n = 8; n > 0 && key[n - 1] == ' '; n--);
+    key[n] = '\0';
+}
+
+//
+// Read the header at the current position of fd, appending its cards to h.
+// Returns 0 at the END card, otherwise non zero with the reason in errmsg.
+//
+static int read_hdu(int fd, const char *path, struct fits_header *h,
+		    char *errmsg, size_t errlen)
+{
+    char block[HDR_BLOCK], key[9];
+    ssize_t r;
+    long nblocks, k;
+
+    for (nblocks = 0; nblocks < HDR_MAXBLOCKS; nblocks++) {
+	r = read(fd, block, HDR_BLOCK);
+	if (r == HDR_BLOCK)
+	    h->datastart += HDR_BLOCK;
+	if (r != HDR_BLOCK) {
+	    snprintf(errmsg, errlen, "%s: %s", path, r < 0 ? strerror(errno)
+		     : "header ends before the END card");
+	    return 1;
+	}
+	if (nblocks == 0 && h->ncards == 0 && memcmp(block, "SIMPLE  =", 9)) {
+	    snprintf(errmsg, errlen, "%s: not a FITS file", path);
+	    return 1;
+	}
+	for (k = 0; k < HDR_BLOCK / HDR_CARD; k++) {
+	    const char *card = block + k * HDR_CARD;
+
+	    card_key(card, key);
+	    if (strcmp(key, "END") == 0)
+		return 0;
+	    if (key[0] == '\0' || strcmp(key, "COMMENT") == 0
+		|| strcmp(key, "HISTORY") == 0)
+		continue;
+	    if (h->ncards == h->allocated) {
+		long allocated = h->allocated ? 2 * h->allocated : 128;
+		void *cards = realloc(h->cards, allocated * sizeof(*h->cards));
+
+		if (cards == NULL) {
+		    snprintf(errmsg, errlen, "Memory allocation error");
+		    return 1;
+		}
+		h->cards = cards;
+		h->allocated = allocated;
+	    }
+	    memcpy(h->cards[h->ncards], card, HDR_CARD);
+	    h->cards[h->ncards++][HDR_CARD] = '\0';
+	}
+    }
+    snprintf(errmsg, errlen, "%s: no END card in %d header blocks", path,
+	     HDR_MAXBLOCKS);
+    return 1;
+}
+
+//
+// Read the keywords of path into h. Returns 0 when the header was read,
+// otherwise non zero with the reason in errmsg. Either way h is released
+// with fitshdr_free.
+//
+int fitshdr_read(const char *path, struct fits_header *h, char *errmsg,
+		 size_t errlen)
+{
+    char value[HDR_CARD];
+    struct stat sb;
+    int fd, status;
+
+    memset(h, 0, sizeof(*h));
+    errmsg[0] = '\0';
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) != 0) {
+	snprintf(errmsg, errlen, "%s: %s", path, strerror(errno));
+	if (fd >= 0)
+	    close(fd);
+	return 1;
+    }
+    h->filesize = sb.st_size;
+    status = read_hdu(fd, path, h, errmsg, errlen);
+    if (!status && fitshdr_value(h, "NAXIS", value, sizeof(value))
+	&& atoi(value) == 0 && fitshdr_value(h, "EXTEND", value, sizeof(value))
+	&& value[0] == 'T') {
+	// a file which ends after the primary header simply has no extension
+	long before = h->ncards;
+	long long datastart = h->datastart;
+
+	if (read_hdu(fd, path, h, errmsg, errlen)) {
+	    h->ncards = before;
+	    h->datastart = datastart;
+	    errmsg[0] = '\0';
+	}
+	h->zimage = fitshdr_value(h, "ZIMAGE", value, sizeof(value))
+	    && value[0] == 'T';
+    }
+    close(fd);
+    return status;
+}
+
+// The value of key as written in the header, see fitshdr_value
+static int card_value(const struct fits_header *h, const char *key,
+		      char *value, size_t len)
+{
+    char cardkey[9];
+    const char *v;
+    long c;
+    size_t n;
+
+    for (c = h->ncards - 1; c >= 0; c--) {
+	card_key(h->cards[c], cardkey);
+	if (strcmp(cardkey, key) == 0 && memcmp(h->cards[c] + 8, "= ", 2) == 0)
+	    break;
+    }
+    if (c < 0)
+	return 0;
+
+    v = h->cards[c] + 10;
+    while (*v == ' ')
+	v++;
+    n = 0;
+    if (*v == '\'') {
+	for (v++; *v != '\0'; v++) {
+	    if (*v == '\'') {
+		if (v[1] != '\'')
+		    break;
+		v++;		// '' is a quote in the string
+	    }
+	    if (n + 1 < len)
+		value[n++] = *v;
+	}
+    } else {
+	for (; *v != '\0' && *v != '/'; v++)
+	    if (n + 1 < len)
+		value[n++] = *v;
+    }
+    while (n > 0 && value[n - 1] == ' ')
+	n--;
+    value[n] = '\0';
+    return 1;
+}
+
+//
+// The value of key, the last one when it appears more than once. Strings are
+// returned without their quotes and trailing spaces, other values as written.
+// Returns 1 when the key was found, otherwise 0.
+//
+int fitshdr_value(const struct fits_header *h, const char *key,
+		  char *value, size_t len)
+{
+    char want[HDR_CARD];
+
+    if (h->zimage && (strcmp(key, "BITPIX") == 0
+		      || strncmp(key, "NAXIS", 5) == 0))
+	snprintf(want, sizeof(want), "Z%s", key);
+    else
+	snprintf(want, sizeof(want), "%s", key);
+    return card_value(h, want, value, len);
+}
+
+void fitshdr_free(struct fits_header *h)
+{
+    free(h->cards);
+    h->cards = NULL;
+    h->ncards = h->allocated = 0;
+}
+
+// The integer value of key, def when it is missing
+static long long int_value(const struct fits_header *h, const char *key,
+			   int raw, long long def)
+{
+    char value[HDR_CARD];
+
+    if (!(raw ? card_value(h, key, value, sizeof(value))
+	  : fitshdr_value(h, key, value, sizeof(value))))
+	return def;
+    return atoll(value);
+}
+
+//
+// Describe the image in path in img and check the file is long enough for
+// it. Returns 0 for a usable image, otherwise non zero with the reason in
+// errmsg.
+//
+int fitshdr_image(const char *path, struct fits_image *img, char *errmsg,
+		  size_t errlen)
+{
+    static const char *compression[] = { "RICE_1", "RICE_ONE", "GZIP_1",
+	"GZIP_2", "PLIO_1", "HCOMPRESS_1", "NOCOMPRESS"
+    };
+    struct fits_header h;
+    char value[HDR_CARD] = "", key[16];
+    long long need;
+    int i, known;
+
+    memset(img, 0, sizeof(*img));
+    img->naxes[0] = img->naxes[1] = img->naxes[2] = 1;
+    if (fitshdr_read(path, &h, errmsg, errlen)) {
+	fitshdr_free(&h);
+	return 1;
+    }
+    img->compressed = h.zimage;
+    img->bitpix = int_value(&h, "BITPIX", 0, 0);
+    img->naxis = int_value(&h, "NAXIS", 0, -1);
+
+    if (img->bitpix != 8 && img->bitpix != 16 && img->bitpix != 32
+	&& img->bitpix != 64 && img->bitpix != -32 && img->bitpix != -64) {
+	snprintf(errmsg, errlen, "%s: BITPIX %d is not valid", path,
+		 img->bitpix);
+	goto bad;
+    }
+    if (img->naxis < 2) {
+	snprintf(errmsg, errlen, "%s: no image, NAXIS = %d", path, img->naxis);
+	goto bad;
+    }
+    need = img->bitpix < 0 ? -img->bitpix / 8 : img->bitpix / 8;
+    for (i = 0; i < img->naxis; i++) {
+	snprintf(key, sizeof(key), "NAXIS%d", i + 1);
+	if (i < 3)
+	    img->naxes[i] = int_value(&h, key, 0, 0);
+	if (int_value(&h, key, 0, 0) <= 0) {
+	    snprintf(errmsg, errlen, "%s: %s is missing or not positive",
+		     path, key);
+	    goto bad;
+	}
+	need *= int_value(&h, key, 0, 0);
+    }
+
+    if (img->compressed) {
+	// the compressed tiles are the rows of the binary table and its heap
+	known = 0;
+	if (card_value(&h, "ZCMPTYPE", value, sizeof(value)))
+	    for (i = 0; i < (int) (sizeof(compression) / sizeof(compression[0])); i++)
+		known |= strcmp(value, compression[i]) == 0;
+	if (!known) {
+	    snprintf(errmsg, errlen, "%s: unknown tile compression %s", path,
+		     value);
+	    goto bad;
+	}
+	need = int_value(&h, "NAXIS1", 1, 0) * int_value(&h, "NAXIS2", 1, 0)
+	    + int_value(&h, "PCOUNT", 1, 0);
+    }
+    if (h.datastart + need > h.filesize) {
+	snprintf(errmsg, errlen, "%s: truncated, %lld bytes of %lld", path,
+		 h.filesize, h.datastart + need);
+	goto bad;
+    }
+    fitshdr_free(&h);
+    return 0;
+
+  bad:
+    fitshdr_free(&h);
+    return 1;
+}
+
+#define ERRLEN 512
+
+// The input set shared by the threads of fitshdr_check_images
+struct check {
+    char *const *paths;
+    long n, next;
+    int maxnaxis;
+    struct fits_image *img;
+    char (*err)[ERRLEN];	// empty for a usable image
+    pthread_mutex_t lock;
+};
+
+static void *check_worker(void *arg)
+{
+    struct check *c = arg;
+    long i;
+
+    for (;;) {
+	pthread_mutex_lock(&c->lock);
+	i = c->next < c->n ? c->next++ : -1;
+	pthread_mutex_unlock(&c->lock);
+	if (i < 0)
+	    return NULL;
+	if (fitshdr_image(c->paths[i], &c->img[i], c->err[i], ERRLEN) == 0
+	    && c->img[i].naxis > c->maxnaxis)
+	    snprintf(c->err[i], ERRLEN,
+		     "%s: images with > %d dimensions are not supported",
+		     c->paths[i], c->maxnaxis);
+    }
+}
+
+//
+// Check the n files in paths are usable images of at most maxnaxis axes.
+// When same is not NULL every image must also be same->naxes[0] by
+// same->naxes[1], or as large as the first usable file when same->naxes[0]
+// is 0, and same is set to that file. imgs, when not NULL, receives the n
+// images. Returns the number of files which failed, with the reason for the
+// first of them in errmsg.
+//
+long fitshdr_check_images(char *const *paths, long n, int maxnaxis,
+			  struct fits_image *same, struct fits_image *imgs,
+			  char *errmsg, size_t errlen)
+{
+    struct check c;
+    pthread_t *threads;
+    long nthreads, t, i, bad = 0;
+
+    errmsg[0] = '\0';
+    if (n <= 0)
+	return 0;
+    memset(&c, 0, sizeof(c));
+    c.paths = paths;
+    c.n = n;
+    c.maxnaxis = maxnaxis;
+    c.img = imgs != NULL ? imgs
+	: (struct fits_image *) calloc(n, sizeof(struct fits_image));
+    c.err = calloc(n, ERRLEN);
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = nthreads < 1 ? 1 : nthreads > n ? n : nthreads;
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    if (c.img == NULL || c.err == NULL || threads == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	if (imgs == NULL)
+	    free(c.img);
+	free(c.err);
+	free(threads);
+	return n;
+    }
+    pthread_mutex_init(&c.lock, NULL);
+
+    // with no threads to be had the files are checked on this one
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&threads[t], NULL, check_worker, &c) != 0)
+	    break;
+    if (t == 0)
+	check_worker(&c);
+    while (t > 0)
+	pthread_join(threads[--t], NULL);
+
+    if (same != NULL && same->naxes[0] == 0)
+	for (i = 0; i < n; i++)
+	    if (c.err[i][0] == '\0') {
+		*same = c.img[i];
+		break;
+	    }
+    for (i = 0; i < n; i++) {
+	if (c.err[i][0] == '\0' && same != NULL
+	    && (c.img[i].naxes[0] != same->naxes[0]
+		|| c.img[i].naxes[1] != same->naxes[1]))
+	    snprintf(c.err[i], ERRLEN, "%s: image is %ld x %ld, not %ld x %ld",
+		     paths[i], c.img[i].naxes[0], c.img[i].naxes[1],
+		     same->naxes[0], same->naxes[1]);
+	if (c.err[i][0] != '\0' && bad++ == 0)
+	    snprintf(errmsg, errlen, "%s", c.err[i]);
+    }
+
+    pthread_mutex_destroy(&c.lock);
+    if (imgs == NULL)
+	free(c.img);
+    free(c.err);
+    free(threads);
+    return bad;
+}
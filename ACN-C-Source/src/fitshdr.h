@@ -0,0 +1,43 @@
+#ifndef FITSHDR_H
+#define FITSHDR_H
+
+#include <stddef.h>
+
+/*
+*      fitshdr.h: Read the header of a FITS file directly, without CFITSIO and without
+*                 reading any data. Safe to use from several threads at once.
+*                 fitshdr_check_images validates a whole input set this way, in parallel,
+*                 before a program opens any of it with CFITSIO.
+*/
+
+#define HDR_BLOCK 2880		// FITS files are made of 2880 byte blocks
+#define HDR_CARD 80		// of 36 cards each
+#define HDR_MAXBLOCKS 1000	// give up on headers longer than this
+
+struct fits_header {
+    long ncards, allocated;
+    char (*cards)[HDR_CARD + 1];
+    int zimage;			// tile compressed image, NAXISn and BITPIX are ZNAXISn, ZBITPIX
+    long long datastart;	// bytes of header read, where the data of the last HDU starts
+    long long filesize;
+};
+
+// The image described by a header
+struct fits_image {
+    int bitpix, naxis;
+    long naxes[3];		// 1 for the axes the image does not have
+    int compressed;		// tile compressed, e.g. by fpack
+};
+
+int fitshdr_read(const char *path, struct fits_header *h, char *errmsg,
+		 size_t errlen);
+int fitshdr_value(const struct fits_header *h, const char *key,
+		  char *value, size_t len);
+void fitshdr_free(struct fits_header *h);
+int fitshdr_image(const char *path, struct fits_image *img, char *errmsg,
+		  size_t errlen);
+long fitshdr_check_images(char *const *paths, long n, int maxnaxis,
+			  struct fits_image *same, struct fits_image *imgs,
+			  char *errmsg, size_t errlen);
+
+#endif
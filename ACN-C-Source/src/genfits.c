@@ -0,0 +1,499 @@
+#include <string.h>
+#include "fitsio.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#define BUFSIZE 2056
+#define MAXSTARS 1000
+
+enum frametype { BIAS, FLAT, OBJECT };
+
+/*
+*      genfits: Generate a synthetic dataset of raw bias, flat and object files for scale testing.
+*
+*                 The dataset follows the layout of the test datasets so gmb, gmf,
+*                 cleanobjectfile, acn-aphot and the queue can be run against it directly:
+*
+*                   outdir/RawBiasFiles/NNNNNNN.fits            bias frames
+*                   outdir/RawFlatFiles/NNNNNNN.fits            flat frames
+*                   outdir/RawObjectFiles/NNNNNNN.fits          object cubes
+*                   outdir/RawObjectFilesCompressed/NNNNNNN.fits.fz  tile compressed copies (-z)
+*                   outdir/MasterFiles/Final-MasterBias-subrect.fits  true bias pattern
+*                   outdir/MasterFiles/Final-MasterFlat.fits          true normalised flat
+*                   outdir/MasterFiles/config                         acn-aphot star config
+*
+*                 raw = bias + readnoise + poisson((sky + stars) * flat) (+ cosmic rays)
+*
+*                 Stars are gaussian PSFs at random positions or at the positions given in an
+*                 acn-aphot config file, optionally drifting by a fixed amount each plane.
+*                 Everything is generated from a fixed seed so a dataset can be reproduced.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+// Dataset parameters, defaults match the 428x426x10 subrect object cubes
+long width = 428, height = 426, depth = 10;
+int nbias = 10, nflat = 10, nobject = 100, nstars = 5, boxdims = 80,
+    cosmics = 0, compress = 0;
+double sky = 100, flux = 200000, fwhm = 4, biaslevel = 230, readnoise = 5,
+    flatlevel = 20000, vignetting = 0.15, exposure = 10, drift = 0;
+unsigned long long seed = 2012, initialseed;
+
+double xstar[MAXSTARS], ystar[MAXSTARS], fluxstar[MAXSTARS];
+char starline[MAXSTARS][BUFSIZE];	// config lines read with -p
+double *biasframe, *flatframe;	// true bias pattern and normalised flat
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: genfits [options] outdir\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -x width    : image width (default 428)\n");
+    fprintf(stderr, "  -y height   : image height (default 426)\n");
+    fprintf(stderr, "  -d depth    : planes per object cube (default 10)\n");
+    fprintf(stderr, "  -b count    : number of bias files (default 10)\n");
+    fprintf(stderr, "  -f count    : number of flat files (default 10)\n");
+    fprintf(stderr, "  -o count    : number of object files (default 100)\n");
+    fprintf(stderr, "  -n stars    : number of randomly placed stars (default 5)\n");
+    fprintf(stderr, "  -p config   : place stars at the positions in an acn-aphot config file\n");
+    fprintf(stderr, "  -B box      : box width written to the generated config (default 80)\n");
+    fprintf(stderr, "  -s sky      : sky level in counts (default 100)\n");
+    fprintf(stderr, "  -F flux     : total counts of the brightest star (default 200000)\n");
+    fprintf(stderr, "  -w fwhm     : star FWHM in pixels (default 4)\n");
+    fprintf(stderr, "  -t drift    : star drift in pixels per plane (default 0)\n");
+    fprintf(stderr, "  -k count    : cosmic ray hits per plane (default 0)\n");
+    fprintf(stderr, "  -z          : also write tile compressed (RICE) object files\n");
+    fprintf(stderr, "  -S seed     : random seed (default 2012)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  genfits ./synthetic\n");
+    fprintf(stderr, "  genfits -o 10000 -d 50 -n 20 -k 3 -z ./synthetic-large\n\n");
+}
+
+//
+// xorshift64* generator, used instead of rand() so a dataset is the same on
+// every platform for a given seed
+//
+double uniform(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return ((seed * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double gaussian(void)
+{
+    double u1 = uniform(), u2 = uniform();
+
+    if (u1 < 1e-300)
+	u1 = 1e-300;
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// Poisson deviate, using the normal approximation for large means
+double poisson(double mean)
+{
+    double L, p = 1;
+    int k = 0;
+
+    if (mean <= 0)
+	return 0;
+    if (mean > 30)
+	return floor(mean + sqrt(mean) * gaussian() + 0.5);
+    L = exp(-mean);
+    do {
+	k++;
+	p *= uniform();
+    } while (p > L);
+    return k - 1;
+}
+
+void makedir(const char *outdir, const char *name)
+{
+    char path[BUFSIZE];
+
+    snprintf(path, BUFSIZE, "%s/%s", outdir, name);
+    if (mkdir(path, 0777) != 0 && access(path, W_OK) != 0)
+	bail("Unable to create directory %s\n", path);
+}
+
+//
+// Create an image file, replacing any previous file of the same name, and
+// write the common keywords. date is in seconds since the epoch.
+//
+fitsfile *create_image(const char *filename, int bitpix, int naxis,
+		       time_t date)
+{
+    fitsfile *fptr;
+    int status = 0;
+    long naxes[3] = { width, height, depth };
+    char path[BUFSIZE + 1], datestr[30], subrect[FLEN_VALUE];
+
+    snprintf(path, sizeof(path), "!%s", filename);	// ! overwrites an existing file
+    fits_create_file(&fptr, path, &status);
+    fits_create_img(fptr, bitpix, naxis, naxes, &status);
+
+    strftime(datestr, sizeof(datestr), "%Y-%m-%dT%H:%M:%S", gmtime(&date));
+    snprintf(subrect, sizeof(subrect), "1, %ld, %ld, 1", width, height);
+    fits_write_key(fptr, TSTRING, "SUBRECT", subrect, "Subimage format",
+		   &status);
+    fits_write_key(fptr, TDOUBLE, "EXPOSURE", &exposure,
+		   "Total Exposure Time", &status);
+    fits_write_key(fptr, TSTRING, "DATE", datestr,
+		   "file creation date (YYYY-MM-DDThh:mm:ss UTC)", &status);
+    fits_write_comment(fptr, "Synthetic data generated by genfits", &status);
+    if (status) {
+	fits_report_error(stderr, status);
+	bail("Unable to create %s\n", filename);
+    }
+    return fptr;
+}
+
+void close_image(fitsfile * fptr, const char *filename)
+{
+    int status = 0;
+
+    fits_close_file(fptr, &status);
+    if (status) {
+	fits_report_error(stderr, status);
+	bail("Unable to write %s\n", filename);
+    }
+}
+
+//
+// Place the stars. With a config file the X,Y positions are taken from it,
+// otherwise stars are placed at random far enough from the edges that their
+// box fits in the image. Fluxes fall off so stars cover a range of magnitudes.
+//
+void place_stars(const char *configfile)
+{
+    FILE *cfp;
+    char buf[BUFSIZE], line[BUFSIZE], *tok;
+    int s;
+    double margin = boxdims / 2 + 1;
+
+    if (configfile != NULL) {
+	if ((cfp = fopen(configfile, "r")) == NULL)
+	    bail("Unable to open config file %s\n", configfile);
+	nstars = 0;
+	while (fgets(buf, BUFSIZE, cfp) != NULL) {
+	    if (buf[0] == '!' || buf[0] == '\n')
+		continue;
+	    if (nstars >= MAXSTARS)
+		bail("too many stars in the config file\n");
+	    strcpy(line, buf);
+	    tok = strtok(buf, " ");
+	    xstar[nstars] = atof(tok);
+	    tok = strtok(NULL, " ");
+	    if (tok == NULL || xstar[nstars] == 0)
+		bail("invalid config file line %s\n", line);
+	    ystar[nstars] = atof(tok);
+	    strcpy(starline[nstars], line);
+	    nstars++;
+	}
+	fclose(cfp);
+    } else {
+	if (width <= 2 * margin || height <= 2 * margin)
+	    bail("Image is too small for a box of %d\n", boxdims);
+	for (s = 0; s < nstars; s++) {
+	    xstar[s] = margin + uniform() * (width - 2 * margin);
+	    ystar[s] = margin + uniform() * (height - 2 * margin);
+	}
+    }
+    for (s = 0; s < nstars; s++)
+	fluxstar[s] = flux / (1 + s * 0.5);
+}
+
+//
+// Generate the true bias pattern (a level with a column gradient) and the
+// normalised flat (radial vignetting with 1% pixel to pixel variation).
+//
+void make_calibration(void)
+{
+    long x, y;
+    double r2, rmax2 = (width * width + height * height) / 4.0, sum = 0;
+
+    biasframe = (double *) malloc(width * height * sizeof(double));
+    flatframe = (double *) malloc(width * height * sizeof(double));
+    if (biasframe == NULL || flatframe == NULL)
+	bail("Memory allocation error\n");
+
+    for (y = 0; y < height; y++) {
+	for (x = 0; x < width; x++) {
+	    r2 = (x - width / 2.0) * (x - width / 2.0) +
+		(y - height / 2.0) * (y - height / 2.0);
+	    biasframe[y * width + x] = biaslevel + 5.0 * x / width;
+	    flatframe[y * width + x] =
+		(1 - vignetting * r2 / rmax2) * (1 + 0.01 * gaussian());
+	    sum += flatframe[y * width + x];
+	}
+    }
+    for (x = 0; x < width * height; x++)
+	flatframe[x] /= sum / (width * height);
+}
+
+// Write the true master files and the star config used by acn-aphot
+void write_masters(const char *outdir)
+{
+    char filename[BUFSIZE];
+    fitsfile *fptr;
+    long fpixel[3] = { 1, 1, 1 };
+    int s, status = 0, threshold;
+    double sigma = fwhm / 2.3548;
+    FILE *cfp;
+
+    snprintf(filename, BUFSIZE, "%s/MasterFiles/Final-MasterBias-subrect.fits", outdir);
+    fptr = create_image(filename, DOUBLE_IMG, 2, 0);
+    if (fits_write_pix(fptr, TDOUBLE, fpixel, width * height, biasframe,
+		       &status)) {
+	fits_report_error(stderr, status);
+	bail("Unable to write %s\n", filename);
+    }
+    close_image(fptr, filename);
+
+    snprintf(filename, BUFSIZE, "%s/MasterFiles/Final-MasterFlat.fits", outdir);
+    fptr = create_image(filename, DOUBLE_IMG, 2, 0);
+    if (fits_write_pix(fptr, TDOUBLE, fpixel, width * height, flatframe,
+		       &status)) {
+	fits_report_error(stderr, status);
+	bail("Unable to write %s\n", filename);
+    }
+    close_image(fptr, filename);
+
+    snprintf(filename, BUFSIZE, "%s/MasterFiles/config", outdir);
+    if ((cfp = fopen(filename, "w")) == NULL)
+	bail("Unable to write %s\n", filename);
+    fprintf(cfp, "! Synthetic star field generated by genfits, seed %llu\n",
+	    initialseed);
+    fprintf(cfp, "! X Y Radius Annulus Dannulus boxwidth Threshold\n");
+    for (s = 0; s < nstars; s++) {
+	if (starline[s][0] != '\0') {
+	    fputs(starline[s], cfp);
+	    continue;
+	}
+	// Threshold a quarter of the way up the cleaned star peak
+	threshold = sky + fluxstar[s] / (2 * M_PI * sigma * sigma) / 4;
+	fprintf(cfp, "%.0f %.0f 15 10 15 %d %d ! Star details %d\n",
+		floor(xstar[s] + 0.5), floor(ystar[s] + 0.5), boxdims,
+		threshold, s + 1);
+    }
+    fclose(cfp);
+}
+
+//
+// Fill one plane of the given type. frame is the plane number across the whole
+// dataset and sets how far the stars have drifted. Each star only touches
+// pixels within 5 sigma.
+//
+void make_plane(float *plane, long frame, int type)
+{
+    long x, y, x0, x1, y0, y1, k;
+    int s;
+    double sigma = fwhm / 2.3548, xc, yc, r2, norm, value;
+    static double *signal = NULL;	// expected counts, reused for every plane
+
+    if (signal == NULL
+	&& (signal = (double *) malloc(width * height * sizeof(double))) == NULL)
+	bail("Memory allocation error\n");
+    for (k = 0; k < width * height; k++)
+	signal[k] = type == OBJECT ? sky : type == FLAT ? flatlevel : 0;
+
+    for (s = 0; type == OBJECT && s < nstars; s++) {
+	// config positions are 1 based FITS pixel coordinates
+	xc = xstar[s] - 1 + drift * frame;
+	yc = ystar[s] - 1 + drift * frame;
+	norm = fluxstar[s] / (2 * M_PI * sigma * sigma);
+	x0 = fmax(0, floor(xc - 5 * sigma));
+	x1 = fmin(width - 1, ceil(xc + 5 * sigma));
+	y0 = fmax(0, floor(yc - 5 * sigma));
+	y1 = fmin(height - 1, ceil(yc + 5 * sigma));
+	for (y = y0; y <= y1; y++)
+	    for (x = x0; x <= x1; x++) {
+		r2 = (x - xc) * (x - xc) + (y - yc) * (y - yc);
+		signal[y * width + x] += norm * exp(-r2 / (2 * sigma * sigma));
+	    }
+    }
+
+    for (k = 0; k < width * height; k++) {
+	plane[k] = biasframe[k] + readnoise * gaussian() +
+	    poisson(signal[k] * flatframe[k]);
+    }
+
+    // Cosmic rays are short bright streaks of two or three pixels
+    for (s = 0; type == OBJECT && s < cosmics; s++) {
+	x = uniform() * (width - 3);
+	y = uniform() * (height - 3);
+	value = 5000 + uniform() * 25000;
+	for (k = 0; k < 2 + (uniform() > 0.5); k++)
+	    plane[(y + k) * width + x + k] += value / (k + 1);
+    }
+}
+
+//
+// Write a series of files of one frame type into outdir/subdir
+//
+void write_series(const char *outdir, const char *subdir, int count,
+		  long planes, int type, time_t start)
+{
+    char filename[BUFSIZE], compressed[BUFSIZE + 8];
+    fitsfile *fptr, *cfptr;
+    long fpixel[3] = { 1, 1, 1 };
+    float *plane = (float *) malloc(width * height * sizeof(float));
+    int f, status = 0;
+    time_t date;
+
+    if (plane == NULL)
+	bail("Memory allocation error\n");
+    makedir(outdir, subdir);
+    if (type == OBJECT && compress)
+	makedir(outdir, "RawObjectFilesCompressed");
+
+    for (f = 0; f < count; f++) {
+	snprintf(filename, BUFSIZE, "%s/%s/%07d.fits", outdir, subdir, f + 1);
+	date = start + (time_t) (f * planes * exposure);
+	fptr = create_image(filename, FLOAT_IMG, planes > 1 ? 3 : 2, date);
+
+	for (fpixel[2] = 1; fpixel[2] <= planes; fpixel[2]++) {
+	    make_plane(plane, f * planes + fpixel[2] - 1, type);
+	    if (fits_write_pix(fptr, TFLOAT, fpixel, width * height, plane,
+			       &status)) {
+		fits_report_error(stderr, status);
+		bail("Unable to write %s\n", filename);
+	    }
+	}
+
+	// Compress the object file the same way fpack does (RICE, one row per tile)
+	if (type == OBJECT && compress) {
+	    snprintf(compressed, sizeof(compressed),
+		     "!%s/RawObjectFilesCompressed/%07d.fits.fz", outdir, f + 1);
+	    fits_create_file(&cfptr, compressed, &status);
+	    fits_set_compression_type(cfptr, RICE_1, &status);
+	    fits_img_compress(fptr, cfptr, &status);
+	    fits_close_file(cfptr, &status);
+	    if (status) {
+		fits_report_error(stderr, status);
+		bail("Unable to write %s\n", compressed + 1);
+	    }
+	}
+	close_image(fptr, filename);
+	printf("Writing ...%s\r", filename);
+	fflush(stdout);
+    }
+    if (count > 0)
+	printf("\n");
+    free(plane);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    char *configfile = NULL;
+    time_t start = 1331323800;	// 2012-03-09T20:10:00 UTC
+    double t0 = time(NULL);
+
+    while ((opt = getopt(argc, argv, "x:y:d:b:f:o:n:p:B:s:F:w:t:k:zS:h")) != -1) {
+	switch (opt) {
+	case 'x':
+	    width = atol(optarg);
+	    break;
+	case 'y':
+	    height = atol(optarg);
+	    break;
+	case 'd':
+	    depth = atol(optarg);
+	    break;
+	case 'b':
+	    nbias = atoi(optarg);
+	    break;
+	case 'f':
+	    nflat = atoi(optarg);
+	    break;
+	case 'o':
+	    nobject = atoi(optarg);
+	    break;
+	case 'n':
+	    nstars = atoi(optarg);
+	    break;
+	case 'p':
+	    configfile = optarg;
+	    break;
+	case 'B':
+	    boxdims = atoi(optarg);
+	    break;
+	case 's':
+	    sky = atof(optarg);
+	    break;
+	case 'F':
+	    flux = atof(optarg);
+	    break;
+	case 'w':
+	    fwhm = atof(optarg);
+	    break;
+	case 't':
+	    drift = atof(optarg);
+	    break;
+	case 'k':
+	    cosmics = atoi(optarg);
+	    break;
+	case 'z':
+	    compress = 1;
+	    break;
+	case 'S':
+	    seed = strtoull(optarg, NULL, 10);
+	    break;
+	default:
+	    usage();
+	    exit(0);
+	}
+    }
+    if (argc - optind != 1) {
+	usage();
+	exit(0);
+    }
+    if (width < 8 || height < 8 || depth < 1 || nstars < 0
+	|| nstars > MAXSTARS || seed == 0)
+	bail("Invalid parameters\n");
+
+    initialseed = seed;
+
+    if (mkdir(argv[optind], 0777) != 0 && access(argv[optind], W_OK) != 0)
+	bail("Unable to create directory %s\n", argv[optind]);
+    makedir(argv[optind], "MasterFiles");
+
+    place_stars(configfile);
+    make_calibration();
+    write_masters(argv[optind]);
+
+    write_series(argv[optind], "RawBiasFiles", nbias, 1, BIAS, start - 3600);
+    write_series(argv[optind], "RawFlatFiles", nflat, 1, FLAT, start - 1800);
+    write_series(argv[optind], "RawObjectFiles", nobject, depth, OBJECT,
+		 start);
+
+    printf("Generated %d bias, %d flat and %d object files (%ldx%ldx%ld, %d stars) in %.0f seconds\n",
+	   nbias, nflat, nobject, width, height, depth, nstars,
+	   time(NULL) - t0);
+
+    free(biasframe);
+    free(flatframe);
+    exit(0);
+}
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <sys/resource.h>
 #include <strings.h>
+#include "fitshdr.h"
 
 // These are used to determine which message should be printed when debugging
 #define  DEBUGLEVEL1 1
@@ -85,7 +86,7 @@ int main(int argc, char *argv[])
     // Variable to help process the fits files
     fitsfile **afptr, *outfptr;  /* FITS file pointers */
     int status = 0;  /* CFITSIO status value MUST be initialized to zero! */
-    int imagecount = 0, anaxis, bnaxis, ii;
+    int imagecount = 0, ii;
     int debuglevel =0; /* Starting debug level is off */
     long npixels = 1, firstpix[3] = {1,1,1};
     long anaxes[3] = {1,1,1}, bnaxes[3]={1,1,1},cnaxes[3]={1,1,1};
@@ -99,6 +100,9 @@ int main(int argc, char *argv[])
     int path_max = pathconf(".", _PC_NAME_MAX);
     char fullfilename[path_max];  //to store path and filename
     struct rlimit rl;
+    char **paths, errmsg[1024];
+    struct fits_image same;
+    long bad;
 
     // Verify we have the correct number of parameters
     // If there are 3 parameters, then the only valid ones are
@@ -126,55 +130,37 @@ int main(int argc, char *argv[])
         fprintf(stderr, "WARNING: Only processing first %d files\n, increase RLIMIT", count);
     }
 
+    // Check every file from its header before opening any of them, in parallel. A bad
+    // or truncated file, or one of a different size, stops the program here rather
+    // than after the others have been opened. The image size is that of the first file.
+    paths = (char **)calloc(count, sizeof(char *));
+    if (paths == NULL) { bail("Memory allocation error\n"); }
+    for (i=0;i<count;++i) {
+        snprintf(fullfilename, path_max - 1, "%s%s", argv[1], files[i]->d_name);
+        if ((paths[i] = strdup(fullfilename)) == NULL) { bail("Memory allocation error\n"); }
+    }
+    same.naxes[0] = 0;
+    bad = fitshdr_check_images(paths, count, 3, &same, NULL, errmsg, sizeof(errmsg));
+    if (bad > 0) {
+        bail("Error: %ld of %d bias files are not usable, the first: %s\n", bad, count, errmsg);
+    }
+    anaxes[0] = same.naxes[0];
+    anaxes[1] = same.naxes[1];
+
     // Allocate enough memory for an array of filepointers
  	afptr = (fitsfile **)calloc(count, sizeof(fitsfile *));
     debug(debuglevel,DEBUGLEVEL1,"Number of .fits files = %d\n",count);
 
     // Open all of the files identified
     for (i=0;i<count;++i) {
-
-		// Generate the complete file name to open
-        snprintf(fullfilename, path_max - 1, "%s%s", argv[1], files[i]->d_name);
-        fits_open_file(&afptr[i], fullfilename, READONLY, &status); // open input images
+        fits_open_file(&afptr[i], paths[i], READONLY, &status); // open input images
         if (status) {
            fits_report_error(stderr, status); // print error message
            bail("failed to open an input file");
         }
+        free(paths[i]);
     }
-
-    // Use the first file to establish the dimensions for images. All files must have
-    // same basic size for a  image, but there may have multiple images in a file.
-    fits_get_img_dim(afptr[0], &anaxis, &status);  // read dimensions of each file
-    fits_get_img_size(afptr[0], 3, anaxes, &status);
-    if (status) {
-        fits_report_error(stderr, status); // print error message
-        bail(NULL);
-    }
-
-    if (anaxis > 3) {
-       bail("Error: File %s in an images with > 3 dimensions and is not supported\n",files[0]->d_name);
-    }
-
-    // additional files must have the same reference size for an image as the first file for processing
-    // to make sense.
-    for (i=0;i<count;++i) {
-        fits_get_img_dim(afptr[i], &bnaxis, &status);  // read dimensions of each file
-        fits_get_img_size(afptr[i], 3, bnaxes, &status);
-
-        if (status) {
-            fits_report_error(stderr, status); // print error message
-            bail(NULL);
-        }
-
-        if (bnaxis > 3) {
-            bail("Error: File %s in an images with > 3 dimensions and is not supported\n",files[i]->d_name);
-        }
-
-        // We only need to check the image size, not the number of images in a file.
-        if (( anaxes[0] != bnaxes[0] || anaxes[1] != bnaxes[1] )) {
-            bail("Error: File %s input image is of a different size don't have same size\n",files[i]->d_name);
-        }
-    }
+    free(paths);
 
 
     // create the new empty output file in the current directory
@@ -9,6 +9,7 @@
 #include <sys/resource.h>
 
 #include <strings.h>
+#include "fitshdr.h"
 
 
 extern  int alphasort();
@@ -52,7 +53,7 @@ int main(int argc, char *argv[])
     fitsfile **afptr, *outfptr;  /* FITS file pointers */
 
     int status = 0;  /* CFITSIO status value MUST be initialized to zero! */
-    int imagecount = 0,imagecount1=0,counter=0,anaxis, bnaxis, ii;
+    int imagecount = 0,imagecount1=0,counter=0, ii;
     long npixels = 1, firstpix[3] = {1,1,1};
     long anaxes[3] = {1,1,1}, bnaxes[3]={1,1,1},cnaxes[3]={1,1,1};
     double *apix, *bpix, *cpix;
@@ -66,6 +67,9 @@ int main(int argc, char *argv[])
     int path_max = pathconf(".", _PC_NAME_MAX);
     char fullfilename[path_max];  //to store path and filename
     struct rlimit rl;
+    char **paths, errmsg[1024];
+    struct fits_image same, *imgs;
+    long bad;
 
 	// variables to help with finding the median
 	double medianval=0;
@@ -97,58 +101,43 @@ int main(int argc, char *argv[])
         fprintf(stderr, "WARNING: Only processing first %d files\n", count);
     }
 
-    afptr = (fitsfile **)calloc(count, sizeof(fitsfile *));
-
-    // Open all of the files
+    // Check every file from its header before opening any of them, in parallel. A bad
+    // or truncated file, or one of a different size, stops the program here rather
+    // than after the others have been opened. The image size is that of the first file
+    // and the headers give the number of images in each file.
+    paths = (char **)calloc(count, sizeof(char *));
+    imgs = (struct fits_image *)calloc(count, sizeof(struct fits_image));
+    if (paths == NULL || imgs == NULL) { bail("Memory allocation error\n"); }
     for (i=0;i<count;++i) {
         snprintf(fullfilename, path_max - 1, "%s%s", argv[1], files[i]->d_name);
-        fits_open_file(&afptr[i], fullfilename, READONLY, &status); // open input images
-        if (status) {
-           fits_report_error(stderr, status); // print error message
-           bail(NULL);
-        }
+        if ((paths[i] = strdup(fullfilename)) == NULL) { bail("Memory allocation error\n"); }
     }
-
-    // Use the first file to establish the dimensions for files. All files must have
-    // same basic size for a  image, but there may have multiple images in a file.
-
-    fits_get_img_dim(afptr[0], &anaxis, &status);  // read dimensions of each file
-    fits_get_img_size(afptr[0], 3, anaxes, &status);
-
-    if (status) {
-        fits_report_error(stderr, status); // print error message
-        bail(NULL);
+    same.naxes[0] = 0;
+    bad = fitshdr_check_images(paths, count, 3, &same, imgs, errmsg, sizeof(errmsg));
+    if (bad > 0) {
+        bail("Error: %ld of %d flat files are not usable, the first: %s\n", bad, count, errmsg);
     }
+    anaxes[0] = same.naxes[0];
+    anaxes[1] = same.naxes[1];
 
-    if (anaxis > 3) {
-       bail("Error: File %s in an images with > 3 dimensions and is not supported\n",files[0]->d_name);
+    //calculate the number of images to process
+    for (i=0;i<count;++i) {
+        imagecount1 += imgs[i].naxes[2];
     }
+    free(imgs);
 
-    // additional files must have the same reference size for an image as the first file for processing
-    // to make sense.
+    afptr = (fitsfile **)calloc(count, sizeof(fitsfile *));
 
+    // Open all of the files
     for (i=0;i<count;++i) {
-        fits_get_img_dim(afptr[i], &bnaxis, &status);  // read dimensions of each file
-        fits_get_img_size(afptr[i], 3, bnaxes, &status);
-
+        fits_open_file(&afptr[i], paths[i], READONLY, &status); // open input images
         if (status) {
-            fits_report_error(stderr, status); // print error message
-            bail(NULL);
-        }
-
-        if (bnaxis > 3) {
-            bail("Error: File %s in an images with > 3 dimensions and is not supported\n",files[i]->d_name);
-        }
-
-        // We only need to check the image size, not the number of images in a file.
-        if (( anaxes[0] != bnaxes[0] || anaxes[1] != bnaxes[1] )) {
-            bail("Error: input images don't have same size\n");
+           fits_report_error(stderr, status); // print error message
+           bail(NULL);
         }
-
-        //calculate the number of images to process
-        imagecount1 += bnaxes[2];
-
+        free(paths[i]);
     }
+    free(paths);
 
 
 	// Allocte space for the median array. The 2D array can hold all the values for each pixel across each
@@ -0,0 +1,627 @@
+#define _XOPEN_SOURCE 700
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "fitshdr.h"
+
+/*
+*      hdrindex: Index selected header keywords of every FITS file under a directory and
+*                select files by them.
+*
+*                 build reads only the header blocks of each .fits .fit .fts or .fz file in the
+*                       tree (see fitshdr.c), on several threads, and writes the chosen
+*                       keywords of all of them to a sorted table, dir/.hdrindex by default.
+*                       Rebuilding an index only reads the files whose size or modification
+*                       time changed since it was written, and keeps its keywords unless -k
+*                       gives others.
+*                 query prints the files, relative to the indexed directory, whose keywords
+*                       meet every condition given, e.g. -w "EXPTIME>30". Values compare as
+*                       numbers when both are numbers, otherwise as strings, which orders ISO
+*                       dates correctly. create-queue -k uses it to queue by metadata.
+*
+*                 The index is a native byte order table: the header, nkeys keyword names,
+*                 a file entry and nkeys values per file in path order, then the strings.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+#define HX_MAGIC "ACNHX1\n"	// 8 byte header of an index
+#define HX_NAME ".hdrindex"	// default index in the indexed directory
+#define HX_KEYLEN 16
+#define HX_DEFAULTKEYS "DATE-OBS,EXPTIME,OBJECT,FILTER,NAXIS1,NAXIS2,NAXIS3,JD"
+#define HX_MAXKEYS 64
+#define HX_MAXCONDITIONS 32
+#define BUFSIZE 2056
+
+struct hx_header {
+    char magic[8];
+    int32_t nkeys, unused;
+    int64_t nfiles, strsize;
+};
+
+struct hx_file {
+    int64_t path;		// offset in the strings
+    int64_t size, mtime;
+};
+
+struct hx_value {
+    double num;			// NaN when the value is not a number
+    int64_t str;		// offset in the strings, -1 when the key is missing
+};
+
+// A file while the index is built
+struct entry {
+    char *path;			// relative to the indexed directory
+    int64_t size, mtime;
+    char **values;		// nkeys values, NULL for a missing key
+    int unreadable;
+};
+
+struct condition {
+    int key;
+    char op[3];
+    char value[BUFSIZE];
+    double num;
+    int isnum;
+};
+
+static char keys[HX_MAXKEYS][HX_KEYLEN];
+static int nkeys;
+static const char *root;
+static struct entry *entries;
+static long nentries, allocated, nextentry;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: hdrindex build [-j threads] [-k key,key...] [-o index] dir\n");
+    fprintf(stderr, "       hdrindex query [-w condition]... [-l] [-c] index|dir\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -j threads   : headers read at once (default one per core)\n");
+    fprintf(stderr, "  -k keys      : keywords to index (default those of the existing index or\n                 %s)\n", HX_DEFAULTKEYS);
+    fprintf(stderr, "  -o index     : index file (default dir/%s)\n", HX_NAME);
+    fprintf(stderr, "  -w condition : KEY op value, op one of = != < <= > >=\n");
+    fprintf(stderr, "  -l           : print the indexed keywords of each file\n");
+    fprintf(stderr, "  -c           : print only the number of files selected\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  hdrindex build /mnt/storage1/AstronomyData/ExpA/dataset1\n");
+    fprintf(stderr, "  hdrindex query -w \"EXPTIME>30\" -w \"DATE-OBS>=2012-02-01\" \\\n");
+    fprintf(stderr, "           -w \"DATE-OBS<2012-03-01\" /mnt/storage1/AstronomyData/ExpA/dataset1\n\n");
+}
+
+static int has_suffix(const char *name, const char *suffix)
+{
+    size_t n = strlen(name), s = strlen(suffix);
+
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+// A whole string which strtod accepts as a number
+static int numeric(const char *s, double *v)
+{
+    char *end;
+
+    *v = strtod(s, &end);
+    return end != s && *end == '\0';
+}
+
+static void parse_keys(const char *list)
+{
+    char buf[BUFSIZE], *k, *save;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    nkeys = 0;
+    for (k = strtok_r(buf, ",", &save); k != NULL;
+	 k = strtok_r(NULL, ",", &save)) {
+	if (nkeys == HX_MAXKEYS)
+	    bail("Error: at most %d keywords can be indexed", nkeys);
+	if (strlen(k) >= HX_KEYLEN)
+	    bail("Error: keyword %s is too long", k);
+	strcpy(keys[nkeys++], k);
+    }
+    if (nkeys == 0)
+	bail("Error: no keywords to index");
+}
+
+static int add_file(const char *path, const struct stat *sb, int type,
+		    struct FTW *ftw)
+{
+    struct entry *e;
+
+    (void) ftw;
+    if (type != FTW_F || !S_ISREG(sb->st_mode))
+	return 0;
+    if (!has_suffix(path, ".fits") && !has_suffix(path, ".fit")
+	&& !has_suffix(path, ".fts") && !has_suffix(path, ".fz"))
+	return 0;
+    if (nentries == allocated) {
+	allocated = allocated ? 2 * allocated : 1024;
+	entries = (struct entry *) realloc(entries,
+					   allocated * sizeof(struct entry));
+	if (entries == NULL)
+	    bail("Memory allocation error");
+    }
+    e = &entries[nentries++];
+    memset(e, 0, sizeof(*e));
+    path += strlen(root);
+    while (*path == '/')
+	path++;
+    if ((e->path = strdup(path)) == NULL)
+	bail("Memory allocation error");
+    e->size = sb->st_size;
+    e->mtime = sb->st_mtime;
+    return 0;
+}
+
+static int compare_entries(const void *X, const void *Y)
+{
+    return strcmp(((const struct entry *) X)->path,
+		  ((const struct entry *) Y)->path);
+}
+
+//
+// An index read into memory
+//
+struct index {
+    char *buf;
+    struct hx_header *h;
+    char (*keys)[HX_KEYLEN];
+    struct hx_file *files;
+    struct hx_value *values;	// nkeys per file
+    char *strings;
+};
+
+// Read an index, returns 0 when there is none or it is not an index
+static int read_index(const char *path, struct index *x)
+{
+    FILE *fp;
+    struct stat sb;
+    size_t need;
+
+    memset(x, 0, sizeof(*x));
+    if (stat(path, &sb) != 0 || (fp = fopen(path, "rb")) == NULL)
+	return 0;
+    if ((x->buf = malloc(sb.st_size + 1)) == NULL)
+	bail("Memory allocation error");
+    if (fread(x->buf, 1, sb.st_size, fp) != (size_t) sb.st_size
+	|| sb.st_size < (off_t) sizeof(struct hx_header)) {
+	fclose(fp);
+	free(x->buf);
+	return 0;
+    }
+    fclose(fp);
+    x->h = (struct hx_header *) x->buf;
+    need = sizeof(struct hx_header) + x->h->nkeys * HX_KEYLEN
+	+ x->h->nfiles * (sizeof(struct hx_file)
+			  + x->h->nkeys * sizeof(struct hx_value))
+	+ x->h->strsize;
+    if (memcmp(x->h->magic, HX_MAGIC, 8) != 0 || need != (size_t) sb.st_size) {
+	free(x->buf);
+	return 0;
+    }
+    x->keys = (char (*)[HX_KEYLEN]) (x->h + 1);
+    x->files = (struct hx_file *) (x->keys + x->h->nkeys);
+    x->values = (struct hx_value *) (x->files + x->h->nfiles);
+    x->strings = (char *) (x->values + x->h->nfiles * x->h->nkeys);
+    return 1;
+}
+
+// The entry of path in x, NULL when it is not there
+static struct hx_file *find_file(const struct index *x, const char *path)
+{
+    long lo = 0, hi = x->h->nfiles - 1, mid;
+    int c;
+
+    while (lo <= hi) {
+	mid = (lo + hi) / 2;
+	c = strcmp(path, x->strings + x->files[mid].path);
+	if (c == 0)
+	    return &x->files[mid];
+	if (c < 0)
+	    hi = mid - 1;
+	else
+	    lo = mid + 1;
+    }
+    return NULL;
+}
+
+//
+// Take over the values of files unchanged since the old index was written,
+// returns the number taken
+//
+static long reuse_old(const struct index *x)
+{
+    struct hx_file *f;
+    long i, reused = 0;
+    int k;
+
+    if (x->h->nkeys != nkeys)
+	return 0;
+    for (k = 0; k < nkeys; k++)
+	if (strncmp(x->keys[k], keys[k], HX_KEYLEN) != 0)
+	    return 0;
+
+    for (i = 0; i < nentries; i++) {
+	struct entry *e = &entries[i];
+
+	f = find_file(x, e->path);
+	if (f == NULL || f->size != e->size || f->mtime != e->mtime)
+	    continue;
+	e->values = (char **) calloc(nkeys, sizeof(char *));
+	if (e->values == NULL)
+	    bail("Memory allocation error");
+	for (k = 0; k < nkeys; k++) {
+	    const struct hx_value *v = &x->values[(f - x->files) * nkeys + k];
+
+	    if (v->str >= 0 && (e->values[k] = strdup(x->strings + v->str))
+		== NULL)
+		bail("Memory allocation error");
+	}
+	reused++;
+    }
+    return reused;
+}
+
+// Worker: read the headers of the entries not taken from the old index
+static void *worker(void *arg)
+{
+    struct fits_header hdr;
+    char path[BUFSIZE], value[HDR_CARD], errmsg[BUFSIZE];
+    long i;
+    int k;
+
+    (void) arg;
+    for (;;) {
+	pthread_mutex_lock(&lock);
+	while (nextentry < nentries && entries[nextentry].values != NULL)
+	    nextentry++;
+	i = nextentry < nentries ? nextentry++ : -1;
+	pthread_mutex_unlock(&lock);
+	if (i < 0)
+	    break;
+
+	snprintf(path, sizeof(path), "%s/%s", root, entries[i].path);
+	if (fitshdr_read(path, &hdr, errmsg, sizeof(errmsg))) {
+	    fprintf(stderr, "Skipping %s\n", errmsg);
+	    entries[i].unreadable = 1;
+	} else {
+	    entries[i].values = (char **) calloc(nkeys, sizeof(char *));
+	    if (entries[i].values == NULL)
+		bail("Memory allocation error");
+	    for (k = 0; k < nkeys; k++)
+		if (fitshdr_value(&hdr, keys[k], value, sizeof(value))
+		    && (entries[i].values[k] = strdup(value)) == NULL)
+		    bail("Memory allocation error");
+	}
+	fitshdr_free(&hdr);
+    }
+    return NULL;
+}
+
+static void write_all(FILE * fp, const void *buf, size_t n, const char *path)
+{
+    if (n > 0 && fwrite(buf, 1, n, fp) != n)
+	bail("Error: writing %s", path);
+}
+
+//
+// Write the entries to path through a temporary file renamed over it, so a
+// query running at the same time sees the old or the new index
+//
+static void write_index(const char *path)
+{
+    struct hx_header h;
+    struct hx_file f;
+    struct hx_value v;
+    char tmp[BUFSIZE + 16];
+    FILE *fp;
+    long i;
+    int k;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+    if ((fp = fopen(tmp, "wb")) == NULL)
+	bail("Error: cannot create %s", tmp);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HX_MAGIC, 8);
+    h.nkeys = nkeys;
+    for (i = 0; i < nentries; i++) {
+	if (entries[i].unreadable)
+	    continue;
+	h.nfiles++;
+	h.strsize += strlen(entries[i].path) + 1;
+	for (k = 0; k < nkeys; k++)
+	    if (entries[i].values[k] != NULL)
+		h.strsize += strlen(entries[i].values[k]) + 1;
+    }
+    write_all(fp, &h, sizeof(h), tmp);
+    write_all(fp, keys, nkeys * HX_KEYLEN, tmp);
+
+    // the strings follow in the same order as they are counted here
+    h.strsize = 0;
+    for (i = 0; i < nentries; i++) {
+	if (entries[i].unreadable)
+	    continue;
+	f.path = h.strsize;
+	f.size = entries[i].size;
+	f.mtime = entries[i].mtime;
+	write_all(fp, &f, sizeof(f), tmp);
+	h.strsize += strlen(entries[i].path) + 1;
+	for (k = 0; k < nkeys; k++)
+	    if (entries[i].values[k] != NULL)
+		h.strsize += strlen(entries[i].values[k]) + 1;
+    }
+    h.strsize = 0;
+    for (i = 0; i < nentries; i++) {
+	if (entries[i].unreadable)
+	    continue;
+	h.strsize += strlen(entries[i].path) + 1;
+	for (k = 0; k < nkeys; k++) {
+	    const char *s = entries[i].values[k];
+
+	    v.str = -1;
+	    v.num = NAN;
+	    if (s != NULL) {
+		v.str = h.strsize;
+		h.strsize += strlen(s) + 1;
+		if (!numeric(s, &v.num))
+		    v.num = NAN;
+	    }
+	    write_all(fp, &v, sizeof(v), tmp);
+	}
+    }
+    for (i = 0; i < nentries; i++) {
+	if (entries[i].unreadable)
+	    continue;
+	write_all(fp, entries[i].path, strlen(entries[i].path) + 1, tmp);
+	for (k = 0; k < nkeys; k++)
+	    if (entries[i].values[k] != NULL)
+		write_all(fp, entries[i].values[k],
+			  strlen(entries[i].values[k]) + 1, tmp);
+    }
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+	unlink(tmp);
+	bail("Error: cannot write %s", path);
+    }
+}
+
+static void build(int argc, char *argv[])
+{
+    struct index old;
+    char indexpath[BUFSIZE];
+    const char *output = NULL;
+    pthread_t *threads;
+    long reused = 0, unreadable = 0, i;
+    int nthreads = 0, keysgiven = 0, c, t, k;
+
+    parse_keys(HX_DEFAULTKEYS);
+    while ((c = getopt(argc, argv, "j:k:o:")) != -1) {
+	switch (c) {
+	case 'j':
+	    nthreads = atoi(optarg);
+	    break;
+	case 'k':
+	    parse_keys(optarg);
+	    keysgiven = 1;
+	    break;
+	case 'o':
+	    output = optarg;
+	    break;
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 1) {
+	usage();
+	exit(1);
+    }
+    root = argv[optind];
+    if (output == NULL) {
+	snprintf(indexpath, sizeof(indexpath), "%s/%s", root, HX_NAME);
+	output = indexpath;
+    }
+    if (nthreads <= 0)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+	nthreads = 1;
+
+    if (nftw(root, add_file, 32, FTW_PHYS) != 0)
+	bail("Error: cannot read directory %s", root);
+    if (nentries > 0)
+	qsort(entries, nentries, sizeof(struct entry), compare_entries);
+
+    if (read_index(output, &old)) {
+	if (!keysgiven) {	// keep the keywords the index was built with
+	    for (nkeys = 0; nkeys < old.h->nkeys && nkeys < HX_MAXKEYS; nkeys++)
+		memcpy(keys[nkeys], old.keys[nkeys], HX_KEYLEN);
+	}
+	reused = reuse_old(&old);
+	free(old.buf);
+    }
+
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    if (threads == NULL)
+	bail("Memory allocation error");
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&threads[t], NULL, worker, NULL) != 0)
+	    bail("Error: cannot start a thread");
+    for (t = 0; t < nthreads; t++)
+	pthread_join(threads[t], NULL);
+    free(threads);
+
+    write_index(output);
+    for (i = 0; i < nentries; i++) {
+	unreadable += entries[i].unreadable;
+	if (entries[i].values != NULL)
+	    for (k = 0; k < nkeys; k++)
+		free(entries[i].values[k]);
+	free(entries[i].values);
+	free(entries[i].path);
+    }
+    free(entries);
+    printf("%ld files indexed in %s, %ld headers read, %ld unchanged, %ld unreadable\n",
+	   nentries - unreadable, output, nentries - reused - unreadable,
+	   reused, unreadable);
+}
+
+static void parse_condition(const char *s, const struct index *x,
+			    struct condition *c)
+{
+    static const char *ops[] = { "!=", "<=", ">=", "=", "<", ">" };
+    char key[HX_KEYLEN];
+    size_t n = strcspn(s, "!<>=");
+    int o;
+
+    if (n == 0 || n >= HX_KEYLEN || s[n] == '\0')
+	bail("Error: bad condition %s, expected KEY op value", s);
+    memcpy(key, s, n);
+    key[n] = '\0';
+    for (c->key = 0; c->key < x->h->nkeys; c->key++)
+	if (strncmp(x->keys[c->key], key, HX_KEYLEN) == 0)
+	    break;
+    if (c->key == x->h->nkeys)
+	bail("Error: %s is not in the index, rebuild it with hdrindex build -k",
+	     key);
+    for (o = 0; o < 6; o++)
+	if (strncmp(s + n, ops[o], strlen(ops[o])) == 0)
+	    break;
+    if (o == 6)
+	bail("Error: bad condition %s, expected KEY op value", s);
+    strcpy(c->op, ops[o]);
+    snprintf(c->value, sizeof(c->value), "%s", s + n + strlen(ops[o]));
+    c->isnum = numeric(c->value, &c->num);
+}
+
+static int meets(const struct index *x, long file, const struct condition *c)
+{
+    const struct hx_value *v = &x->values[file * x->h->nkeys + c->key];
+    int cmp;
+
+    if (v->str < 0)
+	return 0;		// a missing key meets no condition
+    if (c->isnum && !isnan(v->num))
+	cmp = v->num < c->num ? -1 : v->num > c->num;
+    else
+	cmp = strcmp(x->strings + v->str, c->value);
+
+    if (strcmp(c->op, "=") == 0)
+	return cmp == 0;
+    if (strcmp(c->op, "!=") == 0)
+	return cmp != 0;
+    if (strcmp(c->op, "<") == 0)
+	return cmp < 0;
+    if (strcmp(c->op, "<=") == 0)
+	return cmp <= 0;
+    if (strcmp(c->op, ">") == 0)
+	return cmp > 0;
+    return cmp >= 0;
+}
+
+static void query(int argc, char *argv[])
+{
+    struct index x;
+    struct condition *cond;
+    const char *where[HX_MAXCONDITIONS];
+    char indexpath[BUFSIZE];
+    struct stat sb;
+    long f, selected = 0;
+    int nwhere = 0, listkeys = 0, countonly = 0, c, k;
+
+    while ((c = getopt(argc, argv, "w:lc")) != -1) {
+	switch (c) {
+	case 'w':
+	    if (nwhere == HX_MAXCONDITIONS)
+		bail("Error: at most %d conditions", HX_MAXCONDITIONS);
+	    where[nwhere++] = optarg;
+	    break;
+	case 'l':
+	    listkeys = 1;
+	    break;
+	case 'c':
+	    countonly = 1;
+	    break;
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 1) {
+	usage();
+	exit(1);
+    }
+    if (stat(argv[optind], &sb) == 0 && S_ISDIR(sb.st_mode))
+	snprintf(indexpath, sizeof(indexpath), "%s/%s", argv[optind],
+		 HX_NAME);
+    else
+	snprintf(indexpath, sizeof(indexpath), "%s", argv[optind]);
+    if (!read_index(indexpath, &x))
+	bail("Error: %s is not a header index, see hdrindex build", indexpath);
+
+    cond = (struct condition *) malloc((nwhere + 1) * sizeof(*cond));
+    if (cond == NULL)
+	bail("Memory allocation error");
+    for (c = 0; c < nwhere; c++)
+	parse_condition(where[c], &x, &cond[c]);
+
+    for (f = 0; f < x.h->nfiles; f++) {
+	for (c = 0; c < nwhere && meets(&x, f, &cond[c]); c++);
+	if (c < nwhere)
+	    continue;
+	selected++;
+	if (countonly)
+	    continue;
+	printf("%s", x.strings + x.files[f].path);
+	if (listkeys)
+	    for (k = 0; k < x.h->nkeys; k++) {
+		const struct hx_value *v = &x.values[f * x.h->nkeys + k];
+
+		printf(" %.*s=%s", HX_KEYLEN, x.keys[k],
+		       v->str < 0 ? "" : x.strings + v->str);
+	    }
+	printf("\n");
+    }
+    if (countonly)
+	printf("%ld\n", selected);
+    free(cond);
+    free(x.buf);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+	usage();
+	return 1;
+    }
+    optind = 2;			// options follow the command
+    if (strcmp(argv[1], "build") == 0)
+	build(argc, argv);
+    else if (strcmp(argv[1], "query") == 0)
+	query(argc, argv);
+    else {
+	usage();
+	return 1;
+    }
+    return 0;
+}
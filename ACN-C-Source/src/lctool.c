@@ -0,0 +1,166 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "lightcurve.h"
+
+/*
+*      lctool: List, query and merge the per star light curve tables written by acn-aphot -l.
+*
+*                 list  prints the stars in a directory with their blocks, records and time range.
+*                 query prints the records of one star in time order, optionally only those in a
+*                       Julian date range or with one radius. Only the blocks the index shows
+*                       overlapping the range are read.
+*                 merge appends every block of every star in one directory to the tables of the
+*                       same stars in another, which may be on shared storage and appended to
+*                       by other nodes at the same time. run-aphot-queue -l uses it to gather
+*                       each node's light curves once the node has won the queue item.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lctool list dir\n");
+    fprintf(stderr, "       lctool query [-f jd] [-t jd] [-r radius] dir star\n");
+    fprintf(stderr, "       lctool merge fromdir todir\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -f jd     : first Julian date to print (default all)\n");
+    fprintf(stderr, "  -t jd     : last Julian date to print (default all)\n");
+    fprintf(stderr, "  -r radius : print only this aperture radius (default all)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  lctool list ./lightcurves\n");
+    fprintf(stderr, "  lctool query -f 2455962.5 -t 2455963.5 -r 8 ./lightcurves 3\n");
+    fprintf(stderr, "  lctool merge ./Result /mnt/storage1/queue/result/lightcurves\n\n");
+}
+
+void list_stars(const char *dir)
+{
+    struct lc_block *blocks;
+    long *stars, nstars, nblocks, s, b, records;
+    double first, last;
+
+    nstars = lc_stars(dir, &stars);
+    printf("Star  Blocks    Records     First JD      Last JD\n");
+    for (s = 0; s < nstars; s++) {
+	nblocks = lc_read_index(dir, stars[s], &blocks);
+	records = 0;
+	first = DBL_MAX;
+	last = -DBL_MAX;
+	for (b = 0; b < nblocks; b++) {
+	    records += blocks[b].count;
+	    first = fmin(first, blocks[b].jdfirst);
+	    last = fmax(last, blocks[b].jdlast);
+	}
+	printf("%4ld %7ld %10ld %12.5f %12.5f\n", stars[s], nblocks,
+	       records, first, last);
+	free(blocks);
+    }
+    free(stars);
+}
+
+void query_star(const char *dir, long star, double jdfrom, double jdto,
+		double radius)
+{
+    struct lc_record *rec;
+    long n, i;
+
+    n = lc_read(dir, star, jdfrom, jdto, &rec);
+    printf("       JD      Image  Radius     X        Y          S       I       SkyB       Mag Estimate \n");
+    for (i = 0; i < n; i++) {
+	if (!isnan(radius) && rec[i].radius != radius)
+	    continue;
+	printf("%13.6f %5.0f %7.4g %7.4f %7.4f %7.6f %7.6f %7.2f %7.5f \n",
+	       rec[i].jd, rec[i].plane, rec[i].radius, rec[i].x, rec[i].y,
+	       rec[i].sum, rec[i].intensity, rec[i].sky, rec[i].magnitude);
+    }
+    free(rec);
+}
+
+void merge_stars(const char *fromdir, const char *todir)
+{
+    struct lc_block *blocks;
+    struct lc_record *rec = NULL;
+    long *stars, nstars, nblocks, s, b, allocated = 0, records = 0;
+
+    nstars = lc_stars(fromdir, &stars);
+    if (mkdir(todir, 0755) != 0 && errno != EEXIST)
+	bail("Unable to create %s: %s\n", todir, strerror(errno));
+    for (s = 0; s < nstars; s++) {
+	nblocks = lc_read_index(fromdir, stars[s], &blocks);
+	for (b = 0; b < nblocks; b++) {
+	    if (blocks[b].count > allocated) {
+		allocated = blocks[b].count;
+		rec = (struct lc_record *) realloc(rec, allocated *
+						   sizeof(struct
+							  lc_record));
+		if (rec == NULL)
+		    bail("Memory allocation error\n");
+	    }
+	    lc_read_block(fromdir, stars[s], &blocks[b], rec);
+	    lc_append(todir, stars[s], rec, blocks[b].count);
+	    records += blocks[b].count;
+	}
+	free(blocks);
+    }
+    printf("Merged %ld records of %ld stars into %s\n", records, nstars,
+	   todir);
+    free(rec);
+    free(stars);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    double jdfrom = -DBL_MAX, jdto = DBL_MAX, radius = NAN;
+
+    while ((opt = getopt(argc, argv, "f:t:r:h")) != -1) {
+	switch (opt) {
+	case 'f':
+	    jdfrom = atof(optarg);
+	    break;
+	case 't':
+	    jdto = atof(optarg);
+	    break;
+	case 'r':
+	    radius = atof(optarg);
+	    break;
+	default:
+	    usage();
+	    exit(0);
+	}
+    }
+
+    if (argc - optind == 2 && strcmp(argv[optind], "list") == 0)
+	list_stars(argv[optind + 1]);
+    else if (argc - optind == 3 && strcmp(argv[optind], "query") == 0)
+	query_star(argv[optind + 1], atol(argv[optind + 2]), jdfrom, jdto,
+		   radius);
+    else if (argc - optind == 3 && strcmp(argv[optind], "merge") == 0)
+	merge_stars(argv[optind + 1], argv[optind + 2]);
+    else {
+	usage();
+	bail("Invalid parameters\n");
+    }
+    exit(0);
+}
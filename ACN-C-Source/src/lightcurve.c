@@ -0,0 +1,267 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "lightcurve.h"
+
+#define BUFSIZE 2056
+
+void bail(const char *msg, ...);
+
+/*
+*      lightcurve: Append only light curve tables, one per star, with an index for time queries.
+*
+*                 Every call to lc_append adds one block of records to the star's table and one
+*                 entry to its index giving the block's time range, offset and length. Records
+*                 are kept in time order within a block, blocks are in the order they were
+*                 appended, which is not time order once many nodes contribute. A query reads
+*                 the index, reads only the blocks overlapping the time range and sorts the
+*                 matching records by time, plane and radius.
+*
+*                 Appends hold an fcntl write lock on the table so nodes may append to tables
+*                 on shared storage at the same time. The records are written before the index
+*                 entry, so an append interrupted part way leaves unindexed bytes at the end of
+*                 the table which later blocks skip over, never a bad index entry. Readers take
+*                 no lock and ignore a partly written index entry.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+void lc_add(struct lightcurve *lc, const struct lc_record *r)
+{
+    if (lc->nrecords == lc->allocated) {
+	lc->allocated = lc->allocated ? 2 * lc->allocated : 256;
+	lc->rec = (struct lc_record *) realloc(lc->rec,
+					       lc->allocated *
+					       sizeof(struct lc_record));
+	if (lc->rec == NULL)
+	    bail("Memory allocation error\n");
+    }
+    lc->rec[lc->nrecords++] = *r;
+}
+
+static void lc_path(char *path, const char *dir, long star,
+		    const char *ext)
+{
+    snprintf(path, BUFSIZE, "%s/star%04ld.%s", dir, star, ext);
+}
+
+// Write all of buf, bailing on a short write
+static void write_all(int fd, const void *buf, size_t n, const char *path)
+{
+    const char *p = buf;
+    ssize_t w;
+
+    while (n > 0) {
+	w = write(fd, p, n);
+	if (w < 0 && errno == EINTR)
+	    continue;
+	if (w <= 0)
+	    bail("Unable to write %s: %s\n", path, strerror(errno));
+	p += w;
+	n -= w;
+    }
+}
+
+// Check the header of a table or index opened for reading
+static void check_magic(FILE * fp, const char *magic, const char *path)
+{
+    char buf[8];
+
+    if (fread(buf, 1, 8, fp) != 8 || memcmp(buf, magic, 8) != 0)
+	bail("%s is not a light curve file\n", path);
+}
+
+//
+// Append n records for star (from 1) to its table in dir as one block
+//
+void lc_append(const char *dir, long star, const struct lc_record *rec,
+	       long n)
+{
+    char path[BUFSIZE], ipath[BUFSIZE];
+    struct flock lock;
+    struct lc_block b;
+    int fd, ifd;
+    long k;
+
+    if (n < 1)
+	return;
+    lc_path(path, dir, star, "lc");
+    lc_path(ipath, dir, star, "idx");
+
+    // The lock is held until fd is closed, the index is written under it too
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+	bail("Unable to open %s: %s\n", path, strerror(errno));
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &lock) < 0)
+	if (errno != EINTR)
+	    bail("Unable to lock %s: %s\n", path, strerror(errno));
+    if (lseek(fd, 0, SEEK_END) == 0)
+	write_all(fd, LC_MAGIC, 8, path);
+
+    b.offset = lseek(fd, 0, SEEK_END);
+    b.count = n;
+    b.jdfirst = b.jdlast = rec[0].jd;
+    for (k = 1; k < n; k++) {
+	if (rec[k].jd < b.jdfirst)
+	    b.jdfirst = rec[k].jd;
+	if (rec[k].jd > b.jdlast)
+	    b.jdlast = rec[k].jd;
+    }
+    write_all(fd, rec, n * sizeof(struct lc_record), path);
+
+    ifd = open(ipath, O_WRONLY | O_CREAT, 0644);
+    if (ifd < 0)
+	bail("Unable to open %s: %s\n", ipath, strerror(errno));
+    if (lseek(ifd, 0, SEEK_END) == 0)
+	write_all(ifd, LC_INDEXMAGIC, 8, ipath);
+    write_all(ifd, &b, sizeof(b), ipath);
+    close(ifd);
+    close(fd);
+}
+
+//
+// Read the index of star into a new array, returns the number of blocks.
+// A star with no table has no blocks.
+//
+long lc_read_index(const char *dir, long star, struct lc_block **blocks)
+{
+    char path[BUFSIZE];
+    FILE *fp;
+    long n = 0, allocated = 0;
+    struct lc_block b;
+
+    *blocks = NULL;
+    lc_path(path, dir, star, "idx");
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+	return 0;
+    check_magic(fp, LC_INDEXMAGIC, path);
+    while (fread(&b, sizeof(b), 1, fp) == 1) {	// a partial entry is ignored
+	if (n == allocated) {
+	    allocated = allocated ? 2 * allocated : 64;
+	    *blocks = (struct lc_block *) realloc(*blocks,
+						   allocated * sizeof(b));
+	    if (*blocks == NULL)
+		bail("Memory allocation error\n");
+	}
+	(*blocks)[n++] = b;
+    }
+    fclose(fp);
+    return n;
+}
+
+//
+// Read the records of block b of star into rec, which has room for b->count
+//
+void lc_read_block(const char *dir, long star, const struct lc_block *b,
+		   struct lc_record *rec)
+{
+    char path[BUFSIZE];
+    FILE *fp;
+
+    lc_path(path, dir, star, "lc");
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+	bail("Unable to open %s\n", path);
+    check_magic(fp, LC_MAGIC, path);
+    if (fseeko(fp, b->offset, SEEK_SET) != 0
+	|| fread(rec, sizeof(struct lc_record), b->count,
+		 fp) != (size_t) b->count)
+	bail("%s is shorter than its index\n", path);
+    fclose(fp);
+}
+
+static int compare_records(const void *X, const void *Y)
+{
+    const struct lc_record *x = X, *y = Y;
+
+    if (x->jd != y->jd)
+	return x->jd > y->jd ? 1 : -1;
+    if (x->plane != y->plane)
+	return x->plane > y->plane ? 1 : -1;
+    if (x->radius != y->radius)
+	return x->radius > y->radius ? 1 : -1;
+    return 0;
+}
+
+//
+// Read the records of star with jdfrom <= jd <= jdto into a new array in time
+// order, returns the number of records. Only the blocks overlapping the range
+// are read.
+//
+long lc_read(const char *dir, long star, double jdfrom, double jdto,
+	     struct lc_record **rec)
+{
+    struct lc_block *blocks;
+    long nblocks, i, k, m, n = 0, total = 0;
+
+    nblocks = lc_read_index(dir, star, &blocks);
+    for (i = 0; i < nblocks; i++)
+	if (blocks[i].jdlast >= jdfrom && blocks[i].jdfirst <= jdto)
+	    total += blocks[i].count;
+
+    *rec = (struct lc_record *) malloc((total ? total : 1) *
+				       sizeof(struct lc_record));
+    if (*rec == NULL)
+	bail("Memory allocation error\n");
+    for (i = 0; i < nblocks; i++) {
+	if (blocks[i].jdlast < jdfrom || blocks[i].jdfirst > jdto)
+	    continue;
+	lc_read_block(dir, star, &blocks[i], *rec + n);
+	for (k = 0, m = n; k < blocks[i].count; k++)	// keep the records in range
+	    if ((*rec)[n + k].jd >= jdfrom && (*rec)[n + k].jd <= jdto)
+		(*rec)[m++] = (*rec)[n + k];
+	n = m;
+    }
+    free(blocks);
+
+    qsort(*rec, n, sizeof(struct lc_record), compare_records);
+    return n;
+}
+
+static int compare_longs(const void *X, const void *Y)
+{
+    long x = *((const long *) X), y = *((const long *) Y);
+
+    return x > y ? 1 : (x < y ? -1 : 0);
+}
+
+//
+// List the stars with a table in dir into a new array in star order, returns
+// the number of stars
+//
+long lc_stars(const char *dir, long **stars)
+{
+    DIR *dp;
+    struct dirent *entry;
+    long n = 0, allocated = 0, star;
+    char ext[8];
+
+    *stars = NULL;
+    dp = opendir(dir);
+    if (dp == NULL)
+	bail("Unable to open directory %s\n", dir);
+    while ((entry = readdir(dp)) != NULL) {
+	if (sscanf(entry->d_name, "star%ld.%7s", &star, ext) != 2
+	    || strcmp(ext, "idx") != 0)
+	    continue;
+	if (n == allocated) {
+	    allocated = allocated ? 2 * allocated : 64;
+	    *stars = (long *) realloc(*stars, allocated * sizeof(long));
+	    if (*stars == NULL)
+		bail("Memory allocation error\n");
+	}
+	(*stars)[n++] = star;
+    }
+    closedir(dp);
+    qsort(*stars, n, sizeof(long), compare_longs);
+    return n;
+}
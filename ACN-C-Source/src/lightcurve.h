@@ -0,0 +1,49 @@
+#ifndef LIGHTCURVE_H
+#define LIGHTCURVE_H
+
+#include <stdint.h>
+
+/*
+*      lightcurve.h: Per star light curve tables. Each star has an append only table of
+*                    measurements, dir/starNNNN.lc, and an index of the blocks appended
+*                    to it, dir/starNNNN.idx. Stars are numbered from 1 in config order.
+*
+*        Each program provides its own bail() which the tables call on fatal errors.
+*/
+
+#define LC_MAGIC "ACNLC1\n"		// 8 byte header of a table, native byte order
+#define LC_INDEXMAGIC "ACNLX1\n"	// 8 byte header of an index
+
+// One aperture of one star on one plane
+struct lc_record {
+    double jd;			// Julian date of the data file
+    double plane;		// plane of the cube, from 1
+    double radius;
+    double x, y;		// centroid
+    double sum, intensity, sky, magnitude;
+};
+
+// One block of records appended to a table, in time order within the block
+struct lc_block {
+    double jdfirst, jdlast;
+    int64_t offset;		// byte offset of the first record in the table
+    int64_t count;		// records in the block
+};
+
+// Records of one star gathered before they are appended as a block
+struct lightcurve {
+    long nrecords, allocated;
+    struct lc_record *rec;
+};
+
+void lc_add(struct lightcurve *lc, const struct lc_record *r);
+void lc_append(const char *dir, long star, const struct lc_record *rec,
+	       long n);
+long lc_read_index(const char *dir, long star, struct lc_block **blocks);
+long lc_read(const char *dir, long star, double jdfrom, double jdto,
+	     struct lc_record **rec);
+void lc_read_block(const char *dir, long star, const struct lc_block *b,
+		   struct lc_record *rec);
+long lc_stars(const char *dir, long **stars);
+
+#endif
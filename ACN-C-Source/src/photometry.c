@@ -0,0 +1,732 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+#include "photometry.h"
+
+#define C 24
+
+/*
+*      photometry: The aperture photometry kernels used by acn-aphot and acn-performance.
+*                  The master flat and bias arrays are box sized subrects matching the
+*                  data subrect, pass NULL for both when the data is already cleaned.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+/*
+    skybackground: This function will create an annulus and a dannulus around the centre of the object
+                   and calculate the skybackground by finding the MEDIAN value all all pixels found (exludes
+                   partial pixels)
+ */
+int
+skybackground(double centx, double centy, double *subrectarray,
+	      double *mfarray, double *mbarray, int xpos, int ypos,
+	      int boxdims, double annulusval, double dannulusval,
+	      double radius, double *median)
+{
+
+    float By = 0;
+    float Bx = 0;
+    float dist = 0;
+    int pixelmaskcounter = 0;
+    int ii, b, pixelxpos = 0, pixelypos = 0, mask = 0;
+    int rowcounter, colcounter, Npix = 0;
+    float readval = 0, annulus = 0, dannulus = 0;
+    double *epix, I = 0, S = 0, skyB = 50, Magnitude;
+    double *dpix, medianval = 0;
+
+    annulus = radius + annulusval;
+    dannulus = annulus + dannulusval;
+
+    if (dannulus > boxdims / 2) {
+	printf
+	    ("radius = %f, annulus = %f, dannunlus = %f, boxdims/2 = %d \n",
+	     radius, annulus, dannulus, boxdims / 2);
+	bail("Need larger box around centre point to compute dannulus\n");
+    }
+    epix = (double *) malloc(boxdims * boxdims * sizeof(double));	// mem for Mask
+    dpix = (double *) malloc(boxdims * boxdims * sizeof(double));	// max amount of pixels requried
+
+    if (epix == NULL || dpix == NULL)
+	bail("Memory allocation error\n");
+
+    for (ii = 0; ii < boxdims; ii++) {	// loop over the rows
+	rowcounter = 0;
+	for (b = 0; b < boxdims; b++) {	// loop over elements in the rows
+
+
+	    pixelxpos = b + xpos - boxdims / 2;	// Get the x point in the frame not just the subrect
+	    pixelypos = ii + ypos - boxdims / 2;	// Get the y point in the frame not just the subrect
+
+	    dist = euclidian_dist(pixelxpos, pixelypos, centx, centy);	// Find dist to that pixel from the centre
+
+	    //
+	    // This section calculates the % of the pixel intensity to use.
+	    //
+	    if (dist < (dannulus - 0.5) && (dist > (annulus + 0.5))) {
+		if (mfarray != NULL)
+		    dpix[Npix++] = (subrectarray[ii * boxdims + b] - mbarray[ii * boxdims + b]) / mfarray[ii * boxdims + b];	// store the pixel value for sorting later
+		else
+		    dpix[Npix++] = subrectarray[ii * boxdims + b];	// store the pixel value for sorting later
+	    }
+	}
+    }
+
+    qsort(dpix, Npix, sizeof(double), compare_doubles);	// Sort all of the values
+
+    // Find the median value
+    if (Npix % 2 == 0)
+	*median = (dpix[(Npix / 2) - 1] + dpix[(Npix / 2)]) / 2;	// Even
+    else
+	*median = (dpix[((Npix + 1) / 2) - 1]);	// Odd
+
+    free(epix);
+    free(dpix);
+
+    return 0;			// return value when all OK.
+}
+
+
+/*
+    Aperture weights: the weight of a pixel is the exact area of the unit pixel inside the
+    aperture circle. The weights depend only on the radius and where the centre falls within
+    its nearest pixel, so for each radius they are tabulated once for APERTURE_STEPS + 1
+    offsets along each axis and interpolated bilinearly between the four nearest offsets.
+    The interpolated weights always sum to the full area of the circle (pi r^2 when the
+    aperture lies within the box). Tables are kept for the life of the program, one per
+    radius seen, which is not thread safe. aperture_free releases them.
+ */
+struct aperture_table {
+    double radius;
+    int half;			// the window is 2 * half + 1 pixels square
+    float *weight;		// (APERTURE_STEPS + 1)^2 windows, y offset major
+};
+
+static struct aperture_table *tables = NULL;
+static int ntables = 0, tablesallocated = 0;
+
+// The area under sqrt(r^2 - t^2) from 0 to x
+static double chord_area(double x, double r)
+{
+    if (x > r)
+	x = r;
+    else if (x < -r)
+	x = -r;
+    return 0.5 * (x * sqrt(r * r - x * x) + r * r * asin(x / r));
+}
+
+// The area of the unit pixel centred dx, dy from the centre of a circle of radius r
+// that lies inside the circle
+static double pixel_overlap(double dx, double dy, double r)
+{
+    double x0 = dx - 0.5, x1 = dx + 0.5, y0 = dy - 0.5, y1 = dy + 0.5;
+    double nx = fmax(fabs(dx) - 0.5, 0), ny = fmax(fabs(dy) - 0.5, 0);
+    double fx = fabs(dx) + 0.5, fy = fabs(dy) + 0.5;
+    double cut[6], y[2] = { y0, y1 }, s, m, h, area = 0;
+    int n = 0, i;
+
+    if (nx * nx + ny * ny >= r * r)
+	return 0;		// nearest corner is outside
+    if (fx * fx + fy * fy <= r * r)
+	return 1;		// furthest corner is inside
+
+    // Split the pixel into columns where the top and bottom edges of the overlap are
+    // each either a pixel edge or the circle, then integrate each column exactly
+    cut[n++] = fmax(x0, -r);
+    cut[n++] = fmin(x1, r);
+    for (i = 0; i < 2; i++) {
+	if (fabs(y[i]) >= r)
+	    continue;
+	s = sqrt(r * r - y[i] * y[i]);
+	if (-s > cut[0] && -s < cut[1])
+	    cut[n++] = -s;
+	if (s > cut[0] && s < cut[1])
+	    cut[n++] = s;
+    }
+    qsort(cut, n, sizeof(double), compare_doubles);
+
+    for (i = 0; i + 1 < n; i++) {
+	if (cut[i + 1] <= cut[i])
+	    continue;
+	m = (cut[i] + cut[i + 1]) / 2;
+	h = sqrt(r * r - m * m);
+	if (fmin(y1, h) <= fmax(y0, -h))
+	    continue;		// column misses the circle
+	if (y1 < h)
+	    area += y1 * (cut[i + 1] - cut[i]);
+	else
+	    area += chord_area(cut[i + 1], r) - chord_area(cut[i], r);
+	if (y0 > -h)
+	    area -= y0 * (cut[i + 1] - cut[i]);
+	else
+	    area += chord_area(cut[i + 1], r) - chord_area(cut[i], r);
+    }
+    return area;
+}
+
+// Find the weight table for a radius, building it the first time the radius is used
+static struct aperture_table *aperture_weights(double radius)
+{
+    struct aperture_table *t;
+    int i, ox, oy, kx, ky, n;
+    float *w;
+
+    for (i = 0; i < ntables; i++)
+	if (tables[i].radius == radius)
+	    return &tables[i];
+
+    if (ntables == tablesallocated) {
+	tablesallocated = tablesallocated ? tablesallocated * 2 : 8;
+	tables = realloc(tables, tablesallocated * sizeof(*tables));
+	if (tables == NULL)
+	    bail("Memory allocation error\n");
+    }
+    t = &tables[ntables];
+    t->radius = radius;
+    t->half = (int) ceil(radius) + 1;
+    n = 2 * t->half + 1;
+    t->weight =
+	malloc((size_t) (APERTURE_STEPS + 1) * (APERTURE_STEPS + 1) * n * n *
+	       sizeof(float));
+    if (t->weight == NULL)
+	bail("Memory allocation error\n");
+
+    w = t->weight;
+    for (oy = 0; oy <= APERTURE_STEPS; oy++)
+	for (ox = 0; ox <= APERTURE_STEPS; ox++)
+	    for (ky = -t->half; ky <= t->half; ky++)
+		for (kx = -t->half; kx <= t->half; kx++)
+		    *w++ =
+			pixel_overlap(kx + 0.5 - (double) ox / APERTURE_STEPS,
+				      ky + 0.5 - (double) oy / APERTURE_STEPS,
+				      radius);
+    ntables++;
+    return t;
+}
+
+void aperture_free(void)
+{
+    int i;
+
+    for (i = 0; i < ntables; i++)
+	free(tables[i].weight);
+    free(tables);
+    tables = NULL;
+    ntables = tablesallocated = 0;
+}
+
+/*
+    calc_magnitude: Sum the pixels within an aperture of the given radius around the centre of the
+                    object, subtract the sky background and return the sum (S), the intensity (I)
+                    and the magnitude estimate. Partial pixels on the edge of the aperture are
+                    weighted by the fraction of their area inside it (see aperture_weights), only
+                    the window of pixels the aperture can touch is visited.
+ */
+
+int
+calc_magnitude(double centx, double centy, double *subrectarray,
+	       double *mfarray, double *mbarray, int xpos, int ypos,
+	       int boxdims, double radius, double skyB, double *sum,
+	       double *intensity, double *magnitude)
+{
+    struct aperture_table *t;
+    const float *w00, *w01, *w10, *w11;
+    double cx, cy, tx, ty, c00, c01, c10, c11, mask, Npix = 0, I = 0, S = 0;
+    int n, ox, oy, kx0, ky0, kx, ky, ii, b, k;
+
+    if (isnan(centx) || isnan(centy)) {	// no centroid to measure around
+	*sum = *intensity = *magnitude = NAN;
+	return -1;
+    }
+    t = aperture_weights(radius);
+    n = 2 * t->half + 1;
+
+    // Centre in box coordinates, its nearest pixel and the offset within that pixel
+    cx = centx - (xpos - boxdims / 2);
+    cy = centy - (ypos - boxdims / 2);
+    if (cx < -t->half || cy < -t->half || cx > boxdims + t->half
+	|| cy > boxdims + t->half)
+	cx = cy = -2 * t->half;	// aperture misses the box, nothing to sum
+    kx0 = (int) floor(cx + 0.5);
+    ky0 = (int) floor(cy + 0.5);
+    tx = (cx - kx0 + 0.5) * APERTURE_STEPS;
+    ty = (cy - ky0 + 0.5) * APERTURE_STEPS;
+    ox = tx >= APERTURE_STEPS ? APERTURE_STEPS - 1 : (int) tx;
+    oy = ty >= APERTURE_STEPS ? APERTURE_STEPS - 1 : (int) ty;
+    tx -= ox;
+    ty -= oy;
+    c00 = (1 - tx) * (1 - ty);
+    c01 = tx * (1 - ty);
+    c10 = (1 - tx) * ty;
+    c11 = tx * ty;
+    w00 = t->weight + ((size_t) oy * (APERTURE_STEPS + 1) + ox) * n * n;
+    w01 = w00 + n * n;
+    w10 = w00 + (size_t) (APERTURE_STEPS + 1) * n * n;
+    w11 = w10 + n * n;
+
+    for (ky = 0; ky < n; ky++) {	// loop over the rows of the window
+	ii = ky0 + ky - t->half;
+	if (ii < 0 || ii >= boxdims)
+	    continue;
+	for (kx = 0; kx < n; kx++) {	// loop over elements in the rows
+	    b = kx0 + kx - t->half;
+	    k = ky * n + kx;
+	    mask = c00 * w00[k] + c01 * w01[k] + c10 * w10[k] + c11 * w11[k];
+	    if (b < 0 || b >= boxdims || mask == 0)
+		continue;
+
+	    Npix += mask;	// Keep track of the numebr of pixels in the aperture
+
+	    if (mfarray != NULL)
+		S += ((subrectarray[ii * boxdims + b] -
+		       mbarray[ii * boxdims + b]) / mfarray[ii * boxdims +
+							    b]) * mask;
+	    else
+		S += subrectarray[ii * boxdims + b] * mask;
+	}
+    }
+    I = S - (skyB * Npix);
+    *sum = S;
+    *intensity = I;
+    *magnitude = (-2.5 * log10(I)) + C;
+
+    return 0;			// return value when all OK.
+}
+
+
+//
+// Given an array of values representing a rectangular part of the image containing 
+// a point source find the X & Y centroid value
+// Need to pass in the following parameters 
+// 
+//  x,y - these are used to pass the centroid values back to the calling program
+//  subrect - This is the array returned from the fits_read_subset function containing values from a specific region
+//  xpos,ypos - this is the offset X,Y positions use to calculate where the real centroid value is. This was our initial guess
+//  boxdims - width & heigh of the box (assumed to be a square - this is very important!
+//  threshold - value used to determine what value is cutoff for use in the mask.
+//  
+//  The mask is built as one bit per pixel, 64 pixels of a row to a word, rather
+//  than a box sized array of doubles (51KB for an 80x80 box). The row count is
+//  the popcount of the row's words and the column index sum of a word is found
+//  with popcounts against COLMASK[] (bit k of the column number), so the mask
+//  never needs storing and the box is only walked once, row major.
+//
+//  Paul Doyle -  March 2012
+
+static const uint64_t COLMASK[6] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+};
+
+int
+centroid(double *x, double *y, double *subrectarray, double *mfarray,
+	 double *mbarray, int xpos, int ypos, int boxdims, int threshold)
+{
+
+    float By = 0;
+    float Bx = 0;
+    long pixelmaskcounter = 0, rowsum = 0, colsum = 0;
+    int ii, b, w, k, n, rowcounter;
+    float readval;
+    uint64_t bits, packed;
+    unsigned char flag[64];
+    const double *pix;
+
+    for (ii = 0; ii < boxdims; ii++) {
+	rowcounter = 0;
+	for (w = 0; w < boxdims; w += 64) {
+	    // Generate the bitmask for the next 64 pixels of the row. The
+	    // compare writes one flag byte per pixel so it vectorises, then
+	    // each 8 flags are packed into a byte with a multiply (flag byte
+	    // j lands on bit j, the nodes are little endian x86).
+	    n = boxdims - w < 64 ? boxdims - w : 64;
+	    pix = subrectarray + ii * boxdims + w;
+	    if (mfarray != NULL) {
+		const double *mf = mfarray + ii * boxdims + w;
+		const double *mb = mbarray + ii * boxdims + w;
+
+		for (b = 0; b < n; b++) {
+		    readval = (pix[b] - mb[b]) / mf[b];
+		    flag[b] = readval > threshold;
+		}
+	    } else {
+		for (b = 0; b < n; b++) {
+		    readval = pix[b];
+		    flag[b] = readval > threshold;
+		}
+	    }
+	    for (; b < 64; b++)
+		flag[b] = 0;
+	    bits = 0;
+	    for (k = 0; k < 8; k++) {
+		memcpy(&packed, flag + 8 * k, 8);
+		bits |= ((packed * 0x0102040810204080ULL) >> 56) << (8 * k);
+	    }
+
+	    // counter the number of events in the row, and sum their columns
+	    n = __builtin_popcountll(bits);
+	    rowcounter += n;
+	    colsum += (long) w * n;
+	    for (k = 0; k < 6; k++)
+		colsum += (long) __builtin_popcountll(bits & COLMASK[k]) << k;
+	}
+	pixelmaskcounter += rowcounter;
+	rowsum += (long) rowcounter * ii;
+    }
+    By = rowsum;	// By count of pixel row elements
+    Bx = colsum;	// Bx count of pixel column elements
+
+    *x = (Bx / pixelmaskcounter) + xpos - (boxdims / 2);	// return the global location in the frame 
+    *y = (By / pixelmaskcounter) + ypos - (boxdims / 2);
+
+    return 0;
+
+}
+
+/*
+    Centroid methods selected with acn-aphot -m. threshold is the mask centroid above,
+    the others work on the cleaned pixel values in a single row major pass:
+
+      moment   - intensity weighted first moment of the pixels above the threshold
+      iterate  - moment repeated over a window shrinking around the previous estimate
+		 so neighbouring stars and hot pixels drop out of the sum
+      gauss    - circular 2D gaussian fitted to the pixels around the iterated centre,
+		 used for crowded fields where the moment is pulled by neighbours
+ */
+const char *centroidnames[NCENTROIDS] = { "threshold", "moment", "iterate",
+    "gauss"
+};
+
+// Return the centroid method called name, or -1 if there is none
+int centroid_method(const char *name)
+{
+    int m;
+
+    for (m = 0; m < NCENTROIDS; m++)
+	if (strcmp(name, centroidnames[m]) == 0)
+	    return m;
+    return -1;
+}
+
+// Value of pixel k in the box, cleaned when master flat and bias are given
+static double pixel_value(const double *subrectarray, const double *mfarray,
+			  const double *mbarray, int k)
+{
+    if (mfarray != NULL)
+	return (subrectarray[k] - mbarray[k]) / mfarray[k];
+    return subrectarray[k];
+}
+
+//
+// Intensity weighted first moment over the box columns x0..x1 and rows y0..y1.
+// Each pixel is weighted by its value less floorval, pixels at or below it are
+// ignored. The result is in box coordinates. Returns -1 if no pixel is above floorval.
+//
+static int moment_window(double *cx, double *cy, double *subrectarray,
+			 double *mfarray, double *mbarray, int boxdims,
+			 int x0, int y0, int x1, int y1, double floorval)
+{
+    double w, sw = 0, swx = 0, swy = 0, roww;
+    int ii, b;
+
+    if (x0 < 0)
+	x0 = 0;
+    if (y0 < 0)
+	y0 = 0;
+    if (x1 > boxdims - 1)
+	x1 = boxdims - 1;
+    if (y1 > boxdims - 1)
+	y1 = boxdims - 1;
+
+    for (ii = y0; ii <= y1; ii++) {
+	roww = 0;
+	for (b = x0; b <= x1; b++) {
+	    w = pixel_value(subrectarray, mfarray, mbarray,
+			    ii * boxdims + b) - floorval;
+	    if (w > 0) {
+		roww += w;
+		swx += w * b;
+	    }
+	}
+	sw += roww;
+	swy += roww * ii;
+    }
+    if (sw <= 0)
+	return -1;
+
+    *cx = swx / sw;
+    *cy = swy / sw;
+    return 0;
+}
+
+//
+// Weighted first moment centroid of the whole box. If nothing is above the
+// threshold the initial guess is returned along with -1.
+//
+int
+centroid_moment(double *x, double *y, double *subrectarray,
+		double *mfarray, double *mbarray, int xpos, int ypos,
+		int boxdims, int threshold)
+{
+    double cx = boxdims / 2, cy = boxdims / 2;
+    int ret;
+
+    ret = moment_window(&cx, &cy, subrectarray, mfarray, mbarray, boxdims,
+			0, 0, boxdims - 1, boxdims - 1, threshold);
+    *x = cx + xpos - (boxdims / 2);
+    *y = cy + ypos - (boxdims / 2);
+    return ret;
+}
+
+//
+// Weighted first moment recomputed over a window of half width half centred on
+// the previous estimate (cx, cy in box coordinates). The half width shrinks by a
+// quarter each pass down to CENTROID_MINHALF and the loop stops once the centre
+// moves less than CENTROID_CONVERGE pixels at the smallest window. Returns -1 if
+// nothing is above the threshold in the first window.
+//
+static int iterate_window(double *cx, double *cy, int half,
+			  double *subrectarray, double *mfarray,
+			  double *mbarray, int boxdims, int threshold)
+{
+    double nx, ny, shift;
+    int iter;
+
+    for (iter = 0; iter < CENTROID_ITERATIONS; iter++) {
+	if (half < CENTROID_MINHALF)
+	    half = CENTROID_MINHALF;
+	if (moment_window(&nx, &ny, subrectarray, mfarray, mbarray,
+			  boxdims, (int) floor(*cx + 0.5) - half,
+			  (int) floor(*cy + 0.5) - half,
+			  (int) floor(*cx + 0.5) + half,
+			  (int) floor(*cy + 0.5) + half, threshold))
+	    return iter == 0 ? -1 : 0;	// lost the star, keep the last estimate
+	shift = hypot(nx - *cx, ny - *cy);
+	*cx = nx;
+	*cy = ny;
+	if (half == CENTROID_MINHALF && shift < CENTROID_CONVERGE)
+	    break;
+	half = half * 3 / 4;
+    }
+    return 0;
+}
+
+//
+// Fit a circular gaussian to the pixels within CENTROID_GAUSSHALF of cx, cy
+// (box coordinates). The sky is the median of the box border and the fit is
+// the weighted linear least squares solution of
+//
+//     ln(v - sky) = a + b x + c y + d (x^2 + y^2)
+//
+// with weights (v - sky)^2, giving the centre at (-b / 2d, -c / 2d). If the fit
+// is not a peak or lands outside the window cx, cy are left alone.
+//
+static void gauss_fit(double *cx, double *cy, double *subrectarray,
+		      double *mfarray, double *mbarray, int boxdims)
+{
+    double A[4][5] = { {0} }, row[4], sky, v, w, lv, f, gx, gy;
+    double *border;
+    int ii, b, r, c, k, nb = 0, ix, iy;
+
+    border = (double *) malloc(4 * boxdims * sizeof(double));
+    if (border == NULL)
+	bail("Memory allocation error\n");
+    for (b = 0; b < boxdims; b++) {
+	border[nb++] = pixel_value(subrectarray, mfarray, mbarray, b);
+	border[nb++] = pixel_value(subrectarray, mfarray, mbarray,
+				   (boxdims - 1) * boxdims + b);
+    }
+    for (ii = 1; ii < boxdims - 1; ii++) {
+	border[nb++] = pixel_value(subrectarray, mfarray, mbarray,
+				   ii * boxdims);
+	border[nb++] = pixel_value(subrectarray, mfarray, mbarray,
+				   ii * boxdims + boxdims - 1);
+    }
+    qsort(border, nb, sizeof(double), compare_doubles);
+    sky = nb % 2 ? border[nb / 2] : (border[nb / 2 - 1] + border[nb / 2]) / 2;
+    free(border);
+
+    // Normal equations, coordinates relative to the window centre
+    ix = (int) floor(*cx + 0.5);
+    iy = (int) floor(*cy + 0.5);
+    for (ii = iy - CENTROID_GAUSSHALF; ii <= iy + CENTROID_GAUSSHALF; ii++) {
+	if (ii < 0 || ii >= boxdims)
+	    continue;
+	for (b = ix - CENTROID_GAUSSHALF; b <= ix + CENTROID_GAUSSHALF; b++) {
+	    if (b < 0 || b >= boxdims)
+		continue;
+	    v = pixel_value(subrectarray, mfarray, mbarray,
+			    ii * boxdims + b) - sky;
+	    if (v <= 0)
+		continue;
+	    w = v * v;
+	    lv = log(v);
+	    row[0] = 1;
+	    row[1] = b - ix;
+	    row[2] = ii - iy;
+	    row[3] = row[1] * row[1] + row[2] * row[2];
+	    for (r = 0; r < 4; r++) {
+		for (c = 0; c < 4; c++)
+		    A[r][c] += w * row[r] * row[c];
+		A[r][4] += w * row[r] * lv;
+	    }
+	}
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (k = 0; k < 4; k++) {
+	r = k;
+	for (ii = k + 1; ii < 4; ii++)
+	    if (fabs(A[ii][k]) > fabs(A[r][k]))
+		r = ii;
+	if (fabs(A[r][k]) < 1e-12)
+	    return;	// singular, keep the moment centroid
+	for (c = 0; c < 5; c++) {
+	    f = A[k][c];
+	    A[k][c] = A[r][c];
+	    A[r][c] = f;
+	}
+	for (ii = k + 1; ii < 4; ii++) {
+	    f = A[ii][k] / A[k][k];
+	    for (c = k; c < 5; c++)
+		A[ii][c] -= f * A[k][c];
+	}
+    }
+    for (k = 3; k >= 0; k--) {
+	for (c = k + 1; c < 4; c++)
+	    A[k][4] -= A[k][c] * A[c][4];
+	A[k][4] /= A[k][k];
+    }
+    if (A[3][4] >= 0)
+	return;	// not a peak
+
+    gx = -A[1][4] / (2 * A[3][4]);
+    gy = -A[2][4] / (2 * A[3][4]);
+    if (fabs(gx) > CENTROID_GAUSSHALF || fabs(gy) > CENTROID_GAUSSHALF)
+	return;
+
+    *cx = ix + gx;
+    *cy = iy + gy;
+}
+
+//
+// Weighted first moment of the whole box refined by iterate_window()
+//
+int
+centroid_iterate(double *x, double *y, double *subrectarray,
+		 double *mfarray, double *mbarray, int xpos, int ypos,
+		 int boxdims, int threshold)
+{
+    double cx = boxdims / 2, cy = boxdims / 2;
+    int ret;
+
+    ret = moment_window(&cx, &cy, subrectarray, mfarray, mbarray, boxdims,
+			0, 0, boxdims - 1, boxdims - 1, threshold);
+    if (ret == 0)
+	iterate_window(&cx, &cy, boxdims / 2 * 3 / 4, subrectarray,
+		       mfarray, mbarray, boxdims, threshold);
+    *x = cx + xpos - (boxdims / 2);
+    *y = cy + ypos - (boxdims / 2);
+    return ret;
+}
+
+//
+// Iterated centroid refined with gauss_fit(), for crowded fields where the
+// moment is pulled towards neighbouring stars
+//
+int
+centroid_gauss(double *x, double *y, double *subrectarray,
+	       double *mfarray, double *mbarray, int xpos, int ypos,
+	       int boxdims, int threshold)
+{
+    double cx, cy;
+    int ret;
+
+    ret = centroid_iterate(x, y, subrectarray, mfarray, mbarray, xpos,
+			   ypos, boxdims, threshold);
+    if (ret)
+	return ret;
+
+    cx = *x - xpos + (boxdims / 2);
+    cy = *y - ypos + (boxdims / 2);
+    gauss_fit(&cx, &cy, subrectarray, mfarray, mbarray, boxdims);
+    *x = cx + xpos - (boxdims / 2);
+    *y = cy + ypos - (boxdims / 2);
+    return 0;
+}
+
+//
+// Centroid of a star already located on the previous plane. x, y hold the
+// previous centroid (frame coordinates) on entry and the search starts from
+// there with a window of half width half rather than the whole box. Every
+// method is refined with the weighted moment, gauss adds the gaussian fit.
+// Returns -1 and leaves x, y alone if the star is not found in the window.
+//
+int
+track_centroid(int method, double *x, double *y, double *subrectarray,
+	       double *mfarray, double *mbarray, int xpos, int ypos,
+	       int boxdims, int threshold, int half)
+{
+    double cx = *x - xpos + (boxdims / 2), cy = *y - ypos + (boxdims / 2);
+
+    if (iterate_window(&cx, &cy, half, subrectarray, mfarray, mbarray,
+		       boxdims, threshold))
+	return -1;
+    if (method == CENTROID_GAUSS)
+	gauss_fit(&cx, &cy, subrectarray, mfarray, mbarray, boxdims);
+    *x = cx + xpos - (boxdims / 2);
+    *y = cy + ypos - (boxdims / 2);
+    return 0;
+}
+
+// Run the centroid method selected with centroid_method()
+int
+find_centroid(int method, double *x, double *y, double *subrectarray,
+	      double *mfarray, double *mbarray, int xpos, int ypos,
+	      int boxdims, int threshold)
+{
+    switch (method) {
+    case CENTROID_MOMENT:
+	return centroid_moment(x, y, subrectarray, mfarray, mbarray, xpos,
+			       ypos, boxdims, threshold);
+    case CENTROID_ITERATE:
+	return centroid_iterate(x, y, subrectarray, mfarray, mbarray,
+				xpos, ypos, boxdims, threshold);
+    case CENTROID_GAUSS:
+	return centroid_gauss(x, y, subrectarray, mfarray, mbarray, xpos,
+			      ypos, boxdims, threshold);
+    default:
+	centroid(x, y, subrectarray, mfarray, mbarray, xpos, ypos, boxdims,
+		 threshold);
+	return isnan(*x) || isnan(*y) ? -1 : 0; // empty mask
+    }
+}
+
+// Caclulate the distance between a pixel point and the centre of the point source/star
+double
+euclidian_dist(int pixelxpos, int pixelypos, double centx, double centy)
+{
+    return
+	sqrt((((double) pixelxpos - centx) * ((double) pixelxpos -
+					      centx)) +
+	     (((double) pixelypos - centy) * ((double) pixelypos -
+					      centy)));
+}
+
+int compare_doubles(const void *X, const void *Y)
+{
+    double x = *((double *) X);
+    double y = *((double *) Y);
+
+    if (x > y) {
+	return 1;
+    } else {
+	if (x < y) {
+	    return -1;
+	} else {
+	    return 0;
+	}
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef PHOTOMETRY_H
+#define PHOTOMETRY_H
+
+/*
+*      photometry.h: Aperture photometry kernels shared by acn-aphot and acn-performance.
+*
+*        Each program provides its own bail() which the kernels call on fatal errors.
+*/
+
+void bail(const char *msg, ...);
+
+// Centroid methods, see centroidnames[] for the names used on the command line
+enum centroid_methods { CENTROID_THRESHOLD, CENTROID_MOMENT, CENTROID_ITERATE,
+    CENTROID_GAUSS, NCENTROIDS
+};
+#define CENTROID_ITERATIONS 10	// most recentering passes for iterate
+#define CENTROID_MINHALF 4	// smallest window half width for iterate
+#define CENTROID_CONVERGE 0.01	// pixels moved at which iterate has converged
+#define CENTROID_GAUSSHALF 3	// half width of the window for the gaussian fit
+extern const char *centroidnames[NCENTROIDS];
+#define APERTURE_STEPS 16	// centre offsets per pixel tabulated for aperture weights
+
+int centroid(double *x, double *y, double *subrectarray, double *mfarray,
+	     double *mbarray, int xpos, int ypos, int boxdims,
+	     int threshold);
+int centroid_method(const char *name);
+int centroid_moment(double *x, double *y, double *subrectarray,
+		    double *mfarray, double *mbarray, int xpos, int ypos,
+		    int boxdims, int threshold);
+int centroid_iterate(double *x, double *y, double *subrectarray,
+		     double *mfarray, double *mbarray, int xpos, int ypos,
+		     int boxdims, int threshold);
+int centroid_gauss(double *x, double *y, double *subrectarray,
+		   double *mfarray, double *mbarray, int xpos, int ypos,
+		   int boxdims, int threshold);
+int track_centroid(int method, double *x, double *y, double *subrectarray,
+		   double *mfarray, double *mbarray, int xpos, int ypos,
+		   int boxdims, int threshold, int half);
+int find_centroid(int method, double *x, double *y, double *subrectarray,
+		  double *mfarray, double *mbarray, int xpos, int ypos,
+		  int boxdims, int threshold);
+int calc_magnitude(double centx, double centy, double *subrectarray,
+		   double *mfarray, double *mbarray, int xpos, int ypos,
+		   int boxdims, double radius, double skyB, double *sum,
+		   double *intensity, double *magnitude);
+void aperture_free(void);
+int compare_doubles(const void *X, const void *Y);
+int skybackground(double centx, double centy, double *subrectarray,
+		  double *mfarray, double *mbarray, int xpos, int ypos,
+		  int boxdims, double annulusval, double dannulusval,
+		  double radius, double *median);
+double euclidian_dist(int pixelxpos, int pixelypos, double centx,
+		      double centy);
+
+#endif
@@ -0,0 +1,388 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "rangeio.h"
+
+/*
+*      rangeio: Byte range reads from a local file or an HTTP server.
+*
+*                 A location starting http:// is read with HTTP/1.1 Range requests on one
+*                 kept alive connection, reopened when the server closes it (HTTP/1.0
+*                 servers, or an idle timeout between requests). A server which ignores
+*                 the Range header and sends the whole file still works, the file is kept
+*                 in memory and later reads are taken from it, it just saves nothing. Anything
+*                 else is a local path read with pread, which also stands in for the
+*                 server when testing.
+*
+*                 Plain HTTP only: no TLS, no redirects and no chunked replies, which the
+*                 S3 endpoints and the local stand-in servers of simulate-ACN do not use
+*                 for static files.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+//
+// Open location for reading. Returns 0 on success, otherwise non zero with the
+// reason in errmsg. No connection is made until the first read.
+//
+int range_open(struct range_source *src, const char *location, char *errmsg,
+	       size_t errlen)
+{
+    const char *host, *path, *colon;
+    struct stat sb;
+    size_t n;
+
+    memset(src, 0, sizeof(*src));
+    src->fd = -1;
+    src->size = -1;
+    if (strncmp(location, "http://", 7) != 0) {
+	snprintf(src->path, sizeof(src->path), "%s", location);
+	if ((src->fd = open(location, O_RDONLY)) < 0
+	    || fstat(src->fd, &sb) != 0) {
+	    snprintf(errmsg, errlen, "%s: %s", location, strerror(errno));
+	    range_close(src);
+	    return 1;
+	}
+	src->size = sb.st_size;
+	return 0;
+    }
+
+    src->http = 1;
+    host = location + 7;
+    path = strchr(host, '/');
+    if (path == NULL)
+	path = host + strlen(host);
+    colon = memchr(host, ':', path - host);
+    n = (colon != NULL ? colon : path) - host;
+    if (n == 0 || n >= sizeof(src->host)) {
+	snprintf(errmsg, errlen, "%s: no host in the URL", location);
+	return 1;
+    }
+    memcpy(src->host, host, n);
+    src->host[n] = '\0';
+    if (colon != NULL)
+	snprintf(src->port, sizeof(src->port), "%.*s", (int) (path - colon - 1),
+		 colon + 1);
+    else
+	strcpy(src->port, "80");
+    snprintf(src->path, sizeof(src->path), "%s", *path ? path : "/");
+    return 0;
+}
+
+//
+// Close the file or connection. A file kept in memory stays until range_free,
+// reads after range_close reconnect when they need to.
+//
+void range_close(struct range_source *src)
+{
+    if (src->fd >= 0)
+	close(src->fd);
+    src->fd = -1;
+    src->bufpos = src->buflen = 0;
+    src->reused = 0;
+}
+
+void range_free(struct range_source *src)
+{
+    range_close(src);
+    free(src->whole);
+    src->whole = NULL;
+}
+
+static int http_connect(struct range_source *src, char *errmsg, size_t errlen)
+{
+    struct addrinfo hints, *res, *ai;
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rc = getaddrinfo(src->host, src->port, &hints, &res)) != 0) {
+	snprintf(errmsg, errlen, "%s: %s", src->host, gai_strerror(rc));
+	return 1;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+	src->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (src->fd < 0)
+	    continue;
+	if (connect(src->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+	    break;
+	close(src->fd);
+	src->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (src->fd < 0) {
+	snprintf(errmsg, errlen, "%s:%s: unable to connect, %s", src->host,
+		 src->port, strerror(errno));
+	return 1;
+    }
+    return 0;
+}
+
+// Receive more bytes into the buffer, returns the number received, 0 at close
+static ssize_t fill(struct range_source *src)
+{
+    ssize_t r;
+
+    if (src->bufpos > 0) {
+	memmove(src->buf, src->buf + src->bufpos, src->buflen - src->bufpos);
+	src->buflen -= src->bufpos;
+	src->bufpos = 0;
+    }
+    do
+	r = recv(src->fd, src->buf + src->buflen,
+		 RANGE_BUFSIZE - src->buflen, 0);
+    while (r < 0 && errno == EINTR);
+    if (r > 0)
+	src->buflen += r;
+    return r;
+}
+
+//
+// Receive the header of a reply, up to its empty line, into header. Returns
+// 0 when it was read, -1 when the connection closed before any of it, 1 on
+// other errors.
+//
+static int read_header(struct range_source *src, char *header, size_t len)
+{
+    char *end;
+    size_t n;
+    ssize_t r;
+
+    for (;;) {
+	src->buf[src->buflen] = '\0';
+	end = strstr(src->buf + src->bufpos, "\r\n\r\n");
+	if (end != NULL)
+	    break;
+	if (src->buflen - src->bufpos >= RANGE_BUFSIZE)
+	    return 1;		// a header larger than the buffer
+	r = fill(src);
+	if (r <= 0)
+	    return src->buflen == src->bufpos && r == 0 ? -1 : 1;
+    }
+    n = end + 4 - (src->buf + src->bufpos);
+    if (n >= len)
+	return 1;
+    memcpy(header, src->buf + src->bufpos, n);
+    header[n] = '\0';
+    src->bufpos += n;
+    return 0;
+}
+
+// The value of field in header, NULL when it is not there
+static const char *header_field(const char *header, const char *field)
+{
+    const char *line;
+    size_t n = strlen(field);
+
+    for (line = strstr(header, "\r\n"); line != NULL;
+	 line = strstr(line + 2, "\r\n")) {
+	if (strncasecmp(line + 2, field, n) == 0 && line[2 + n] == ':') {
+	    line += 3 + n;
+	    while (*line == ' ')
+		line++;
+	    return line;
+	}
+    }
+    return NULL;
+}
+
+//
+// Read len bytes of the body into dest, or drop them when dest is NULL.
+// Returns 0 when they were all received.
+//
+static int read_body(struct range_source *src, char *dest, long long len)
+{
+    size_t n;
+
+    while (len > 0) {
+	if (src->bufpos == src->buflen) {
+	    src->bufpos = src->buflen = 0;
+	    if (fill(src) <= 0)
+		return 1;
+	}
+	n = src->buflen - src->bufpos;
+	if ((long long) n > len)
+	    n = len;
+	if (dest != NULL) {
+	    memcpy(dest, src->buf + src->bufpos, n);
+	    dest += n;
+	}
+	src->bufpos += n;
+	src->transferred += n;
+	len -= n;
+    }
+    return 0;
+}
+
+//
+// One Range request on the open connection. Returns the bytes read, -1 on an
+// error with the reason in errmsg, or -2 when a reused connection turned out
+// to be closed by the server and the request can be sent again.
+//
+static long long http_request(struct range_source *src, long long offset,
+			      long long len, char *dest, char *errmsg,
+			      size_t errlen)
+{
+    char request[RANGE_URLLEN + 512], header[8192];
+    const char *v;
+    long long length, first, last, total, got;
+    int code, rc, keep;
+    size_t sent, n;
+    ssize_t w;
+
+    n = snprintf(request, sizeof(request),
+		 "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%lld-%lld\r\n"
+		 "Connection: keep-alive\r\nUser-Agent: acn-rangeio\r\n\r\n",
+		 src->path, src->host, offset, offset + len - 1);
+    for (sent = 0; sent < n; sent += w)
+	if ((w = send(src->fd, request + sent, n - sent, MSG_NOSIGNAL)) <= 0) {
+	    snprintf(errmsg, errlen, "%s%s: unable to send the request",
+		     src->host, src->path);
+	    return src->reused ? -2 : -1;
+	}
+    src->requests++;
+
+    rc = read_header(src, header, sizeof(header));
+    if (rc != 0) {
+	if (rc < 0 && src->reused)
+	    return -2;
+	snprintf(errmsg, errlen, "%s%s: no reply from the server",
+		 src->host, src->path);
+	return -1;
+    }
+    if (sscanf(header, "HTTP/%*d.%*d %d", &code) != 1) {
+	snprintf(errmsg, errlen, "%s%s: bad reply", src->host, src->path);
+	return -1;
+    }
+    keep = strncmp(header, "HTTP/1.1", 8) == 0;
+    if ((v = header_field(header, "Connection")) != NULL)
+	keep = strncasecmp(v, "close", 5) != 0;
+    if ((v = header_field(header, "Transfer-Encoding")) != NULL
+	&& strncasecmp(v, "chunked", 7) == 0) {
+	snprintf(errmsg, errlen, "%s%s: chunked replies are not supported",
+		 src->host, src->path);
+	return -1;
+    }
+    v = header_field(header, "Content-Length");
+    length = v != NULL ? atoll(v) : -1;
+
+    if (code == 416) {		// the range starts past the end of the file
+	if ((v = header_field(header, "Content-Range")) != NULL
+	    && sscanf(v, "bytes */%lld", &total) == 1)
+	    src->size = total;
+	got = 0;
+	if (length > 0 && read_body(src, NULL, length))
+	    keep = 0;
+    } else if (code == 206) {
+	v = header_field(header, "Content-Range");
+	if (v == NULL || sscanf(v, "bytes %lld-%lld/%lld", &first, &last,
+				&total) != 3 || first != offset) {
+	    snprintf(errmsg, errlen, "%s%s: bad Content-Range in the reply",
+		     src->host, src->path);
+	    return -1;
+	}
+	src->size = total;
+	got = last - first + 1;
+	if (got > len)
+	    got = len;
+	if (read_body(src, dest, got)
+	    || read_body(src, NULL, last - first + 1 - got)) {
+	    snprintf(errmsg, errlen, "%s%s: connection lost in the reply",
+		     src->host, src->path);
+	    return -1;
+	}
+    } else if (code == 200) {
+	// the whole file, kept for the reads to come
+	if (length < 0) {
+	    snprintf(errmsg, errlen, "%s%s: reply without a length",
+		     src->host, src->path);
+	    return -1;
+	}
+	if ((src->whole = (char *) malloc(length > 0 ? length : 1)) == NULL) {
+	    snprintf(errmsg, errlen, "Memory allocation error");
+	    return -1;
+	}
+	src->size = length;
+	if (read_body(src, src->whole, length)) {
+	    snprintf(errmsg, errlen, "%s%s: connection lost in the reply",
+		     src->host, src->path);
+	    free(src->whole);
+	    src->whole = NULL;
+	    return -1;
+	}
+	first = offset < length ? offset : length;
+	got = offset + len < length ? len : length - first;
+	memcpy(dest, src->whole + first, got);
+    } else {
+	snprintf(errmsg, errlen, "%s%s: HTTP %d", src->host, src->path, code);
+	return -1;
+    }
+    if (keep)
+	src->reused = 1;
+    else
+	range_close(src);
+    return got;
+}
+
+//
+// Read len bytes from offset into dest. Returns the number of bytes read,
+// fewer than len only at the end of the file, or -1 with the reason in errmsg.
+//
+long long range_read(struct range_source *src, long long offset,
+		     long long len, char *dest, char *errmsg, size_t errlen)
+{
+    long long got;
+    ssize_t r;
+    int attempt;
+
+    if (len <= 0)
+	return 0;
+    if (!src->http) {
+	for (got = 0; got < len; got += r) {
+	    r = pread(src->fd, dest + got, len - got, offset + got);
+	    if (r < 0 && errno == EINTR)
+		r = 0;
+	    else if (r < 0) {
+		snprintf(errmsg, errlen, "%s: %s", src->path, strerror(errno));
+		return -1;
+	    } else if (r == 0)
+		break;
+	}
+	src->requests++;
+	src->transferred += got;
+	return got;
+    }
+
+    if (src->size >= 0 && offset >= src->size)
+	return 0;
+    if (src->whole != NULL) {
+	got = offset + len < src->size ? len : src->size - offset;
+	memcpy(dest, src->whole + offset, got);
+	return got;
+    }
+    for (attempt = 0; attempt < 2; attempt++) {
+	if (src->fd < 0 && http_connect(src, errmsg, errlen))
+	    return -1;
+	got = http_request(src, offset, len, dest, errmsg, errlen);
+	if (got != -2)
+	    break;
+	range_close(src);	// closed while idle, once more on a new connection
+    }
+    if (got < 0) {
+	if (got == -2)
+	    snprintf(errmsg, errlen, "%s%s: the server closed the connection",
+		     src->host, src->path);
+	range_close(src);
+	return -1;
+    }
+    return got;
+}
@@ -0,0 +1,36 @@
+#ifndef RANGEIO_H
+#define RANGEIO_H
+
+#include <stddef.h>
+
+/*
+*      rangeio.h: Read byte ranges of a file which is either local or served over
+*                 HTTP, so a program can take the parts of a large file it needs
+*                 without downloading the rest.
+*/
+
+#define RANGE_URLLEN 1024
+#define RANGE_BUFSIZE 65536
+
+struct range_source {
+    int http;			// served over HTTP rather than a local path
+    int fd;			// the file, or the connection to the server, -1 when closed
+    char host[256], port[16];
+    char path[RANGE_URLLEN];	// of the file on the server, or the local path
+    long long size;		// of the whole file, -1 until a reply gives it
+    long long transferred;	// bytes read from the file or the network
+    long requests;		// range requests made
+    int reused;			// the connection has answered a request before
+    char *whole;		// the file, once a server that ignores Range has sent it
+    char buf[RANGE_BUFSIZE + 1];	// bytes received and not yet used
+    size_t bufpos, buflen;
+};
+
+int range_open(struct range_source *src, const char *location, char *errmsg,
+	       size_t errlen);
+long long range_read(struct range_source *src, long long offset,
+		     long long len, char *dest, char *errmsg, size_t errlen);
+void range_close(struct range_source *src);
+void range_free(struct range_source *src);
+
+#endif
@@ -1,84 +1,312 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
 #include "fitsio.h"
 
 /*
-** Print entire file or points within in a 2D images 
+*      showdata: Print the pixels of one pixel, a region or a range of planes of an image or cube.
+*
+*                 Only the requested region is read from the file, one plane at a time with
+*                 fits_read_subset, so looking at a star in a large cube reads a few hundred
+*                 pixels rather than whole frames. Pixels are printed as text, CSV or raw
+*                 doubles for other programs, and -s adds the statistics of the region in each
+*                 plane and over all of them.
+*
+*                 Coordinates are 1 based as in the catalog, x is the column and y the row.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
 */
 
-int main(int argc, char *argv[])
+enum { FORMAT_TEXT, FORMAT_CSV, FORMAT_BINARY };
+
+struct region_stats {
+    long long n, nnan;
+    double sum, sumsq;
+    double min, max;
+    long minp, minx, miny, maxp, maxx, maxy;
+};
+
+void bail(const char *msg, ...)
 {
-    fitsfile *afptr ;  /* FITS file pointers */
-    int status = 0;  /* CFITSIO status value MUST be initialized to zero! */
-    int atype, btype, anaxis, bnaxis, check = 1, ii, op,errorcounter=0;
-    long npixels = 1, firstpix[3] = {1,1,1}, ntodo;
-    long anaxes[3] = {1,1,1}, bnaxes[3]={1,1,1};
-    double *apix, value;
-
-    if (argc != 3) {
-      printf("Usage: showdata image1 plane x y\n");
-      printf("\n");
-      printf("Examples: show first pixel in first plane\n");
-      printf("  showdata in1.fits 1 1 1   \n");
-      return(0);
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
     }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
 
-    fits_open_file(&afptr, argv[1], READONLY, &status); /* open input images */
-    if (status) {
-       fits_report_error(stderr, status); /* print error message */
-       return(status);
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: showdata [options] image [plane x y]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -p first[:last] : planes to show (default all)\n");
+    fprintf(stderr, "  -x first[:last] : columns to show (default all)\n");
+    fprintf(stderr, "  -y first[:last] : rows to show (default all)\n");
+    fprintf(stderr, "  -c x,y,r        : the box of half width r around pixel x,y, clipped to the image\n");
+    fprintf(stderr, "  -f format       : text, csv or binary (default text)\n");
+    fprintf(stderr, "  -s              : print the statistics of the region\n");
+    fprintf(stderr, "  -q              : do not print the pixels\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  binary writes the region as doubles in the machine's byte order, x\n");
+    fprintf(stderr, "  fastest then y then plane. Statistics go to stderr with binary output.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  showdata in1.fits 1 1 1                show first pixel in first plane\n");
+    fprintf(stderr, "  showdata -c 512,300,10 -p 1:50 -s -q cube.fits\n");
+    fprintf(stderr, "  showdata -x 100:200 -y 100:200 -f csv in1.fits > region.csv\n\n");
+}
+
+//
+// Parse "n" or "first:last" into a range, returns 0 when it is not one
+//
+static int parse_range(const char *s, long *first, long *last)
+{
+    char *end;
+
+    *first = strtol(s, &end, 10);
+    if (end == s)
+	return 0;
+    if (*end == '\0') {
+	*last = *first;
+	return 1;
     }
+    if (*end != ':')
+	return 0;
+    s = end + 1;
+    *last = strtol(s, &end, 10);
+    return end != s && *end == '\0';
+}
 
-    fits_get_img_dim(afptr, &anaxis, &status);  /* read dimensions */
-    fits_get_img_size(afptr, 3, anaxes, &status);
+static void stats_init(struct region_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->min = INFINITY;
+    st->max = -INFINITY;
+}
 
-    if (status) {
-       fits_report_error(stderr, status); /* print error message */
-       return(status);
+static void stats_add(struct region_stats *st, double v, long p, long x,
+		      long y)
+{
+    if (isnan(v)) {
+	st->nnan++;
+	return;
+    }
+    st->n++;
+    st->sum += v;
+    st->sumsq += v * v;
+    if (v < st->min) {
+	st->min = v;
+	st->minp = p;
+	st->minx = x;
+	st->miny = y;
+    }
+    if (v > st->max) {
+	st->max = v;
+	st->maxp = p;
+	st->maxx = x;
+	st->maxy = y;
     }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
 
-    if (anaxis > 3) {
-       printf("Error: images with > 3 dimensions are not supported\n");
-       check = 0;
+//
+// Print st for label, with the median of the n values in v when v is not NULL.
+// v is sorted in place.
+//
+static void stats_print(FILE * out, const char *label,
+			const struct region_stats *st, double *v, long n)
+{
+    double mean, sd;
+    long m, k;
+
+    fprintf(out, "%s: %lld pixels", label, st->n);
+    if (st->nnan > 0)
+	fprintf(out, " (%lld NaN)", st->nnan);
+    if (st->n == 0) {
+	fprintf(out, "\n");
+	return;
+    }
+    mean = st->sum / st->n;
+    sd = st->n > 1 ? sqrt(fmax(0, (st->sumsq - st->sum * mean) /
+			       (st->n - 1))) : 0;
+    fprintf(out, ", sum %.10g, mean %.10g, stddev %.10g", st->sum, mean, sd);
+    if (v != NULL) {
+	for (m = k = 0; k < n; k++)
+	    if (!isnan(v[k]))
+		v[m++] = v[k];
+	qsort(v, m, sizeof(double), compare_doubles);
+	fprintf(out, ", median %.10g",
+		m % 2 ? v[m / 2] : (v[m / 2 - 1] + v[m / 2]) / 2);
     }
+    fprintf(out, "\n%*s  min %.10g at plane %ld, x %ld, y %ld; max %.10g at plane %ld, x %ld, y %ld\n",
+	    (int) strlen(label), "", st->min, st->minp, st->minx, st->miny,
+	    st->max, st->maxp, st->maxx, st->maxy);
+}
 
+int main(int argc, char *argv[])
+{
+    fitsfile *afptr;		/* FITS file pointers */
+    int status = 0;		/* CFITSIO status value MUST be initialized to zero! */
+    int anaxis, c, format = FORMAT_TEXT, showstats = 0, showpixels = 1;
+    int clip = 0;
+    long anaxes[3] = { 1, 1, 1 }, fpixel[3], lpixel[3], inc[3] = { 1, 1, 1 };
+    long range[3][2] = { {1, 0}, {1, 0}, {1, 0} };	// x, y, plane, 0 last for all
+    long cx, cy, cr, nx, ny, npixels, ii, x, y, p;
+    double *apix, *sorted = NULL;
+    struct region_stats planestats, allstats;
+    char label[64];
+    FILE *out = stdout;
 
-      npixels = anaxes[0];  /* no. of pixels to read in each row */
-      apix = (double *) malloc(npixels * sizeof(double)); /* mem for 1 row */
+    while ((c = getopt(argc, argv, "p:x:y:c:f:sqh")) != -1) {
+	switch (c) {
+	case 'p':
+	case 'x':
+	case 'y':
+	    ii = c == 'x' ? 0 : c == 'y' ? 1 : 2;
+	    if (!parse_range(optarg, &range[ii][0], &range[ii][1]))
+		bail("Error: bad range %s, expected n or first:last", optarg);
+	    break;
+	case 'c':
+	    if (sscanf(optarg, "%ld,%ld,%ld", &cx, &cy, &cr) != 3 || cr < 0
+		|| cx + cr < 1 || cy + cr < 1)
+		bail("Error: bad box %s, expected x,y,r", optarg);
+	    range[0][0] = cx - cr;
+	    range[0][1] = cx + cr;
+	    range[1][0] = cy - cr;
+	    range[1][1] = cy + cr;
+	    clip = 1;
+	    break;
+	case 'f':
+	    if (strcmp(optarg, "text") == 0)
+		format = FORMAT_TEXT;
+	    else if (strcmp(optarg, "csv") == 0)
+		format = FORMAT_CSV;
+	    else if (strcmp(optarg, "binary") == 0)
+		format = FORMAT_BINARY;
+	    else
+		bail("Error: unknown format %s", optarg);
+	    break;
+	case 's':
+	    showstats = 1;
+	    break;
+	case 'q':
+	    showpixels = 0;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (argc - optind == 4) {	// showdata image plane x y
+	range[2][0] = range[2][1] = atol(argv[optind + 1]);
+	range[0][0] = range[0][1] = atol(argv[optind + 2]);
+	range[1][0] = range[1][1] = atol(argv[optind + 3]);
+    } else if (argc - optind != 1) {
+	usage();
+	return 1;
+    }
+    if (format == FORMAT_BINARY && showpixels && isatty(STDOUT_FILENO))
+	bail("Error: not writing binary pixels to a terminal");
+    if (format == FORMAT_BINARY)
+	out = stderr;		// keep the statistics out of the pixels
 
-      if (apix == NULL) {
-        printf("Memory allocation error\n");
-        return(1);
-  	  }
+    fits_open_file(&afptr, argv[optind], READONLY, &status);	/* open input images */
+    fits_get_img_dim(afptr, &anaxis, &status);	/* read dimensions */
+    fits_get_img_size(afptr, 3, anaxes, &status);
+    if (status) {
+	fits_report_error(stderr, status);	/* print error message */
+	return (status);
+    }
+    if (anaxis > 3)
+	bail("Error: images with > 3 dimensions are not supported");
 
+    for (ii = 0; ii < 3; ii++) {
+	if (clip && ii < 2) {	// a box around a star near the edge
+	    range[ii][0] = range[ii][0] < 1 ? 1 : range[ii][0];
+	    range[ii][1] = range[ii][1] > anaxes[ii] ? anaxes[ii] : range[ii][1];
+	}
+	if (range[ii][1] == 0)
+	    range[ii][1] = anaxes[ii];
+	if (range[ii][0] < 1 || range[ii][1] > anaxes[ii]
+	    || range[ii][0] > range[ii][1])
+	    bail("Error: %s %ld:%ld is outside 1:%ld",
+		 ii == 0 ? "x" : ii == 1 ? "y" : "plane", range[ii][0],
+		 range[ii][1], anaxes[ii]);
+	fpixel[ii] = range[ii][0];
+	lpixel[ii] = range[ii][1];
+    }
 
-  /* loop over all planes of the cube (2D images have 1 plane) */
-      for (firstpix[2] = 1; firstpix[2] <= 2; firstpix[2]++)
-      {
-        /* loop over all rows of the plane */
-        for (firstpix[1] = 1; firstpix[1] <= anaxes[1]; firstpix[1]++)
-        {
-          /* Read both images as doubles, regardless of actual datatype.  */
-          /* Give starting pixel coordinate and no. of pixels to read.    */
-          /* This version does not support undefined pixels in the image. */
+    nx = lpixel[0] - fpixel[0] + 1;
+    ny = lpixel[1] - fpixel[1] + 1;
+    npixels = nx * ny;		/* pixels in the region of one plane */
+    apix = (double *) malloc(npixels * sizeof(double));
+    if (showstats)
+	sorted = (double *) malloc(npixels * sizeof(double));
+    if (apix == NULL || (showstats && sorted == NULL))
+	bail("Memory allocation error");
 
-          if (fits_read_pix(afptr, TDOUBLE, firstpix, npixels, NULL, apix,
-                            NULL, &status))
-	    	break;   /* jump out of loop on error */
-          for(ii=0; ii< npixels; ii++)
-	  	printf ("plane = %ld, r %ld, c %d, %*.*f\n",firstpix[2],firstpix[1],ii,11,10,apix[ii]);
-			  	errorcounter++;
-        }
-      }    /* end of loop over planes */
+    if (format == FORMAT_CSV && showpixels)
+	printf("plane,x,y,value\n");
+    stats_init(&allstats);
+    for (p = range[2][0]; p <= range[2][1]; p++) {
+	fpixel[2] = lpixel[2] = p;
+	if (fits_read_subset(afptr, TDOUBLE, fpixel, lpixel, inc, NULL, apix,
+			     NULL, &status))
+	    break;		/* jump out of loop on error */
 
+	if (showpixels) {
+	    if (format == FORMAT_BINARY) {
+		if (fwrite(apix, sizeof(double), npixels, stdout) !=
+		    (size_t) npixels)
+		    bail("Error: writing the pixels");
+	    } else {
+		for (ii = 0; ii < npixels; ii++) {
+		    x = fpixel[0] + ii % nx;
+		    y = fpixel[1] + ii / nx;
+		    if (format == FORMAT_CSV)
+			printf("%ld,%ld,%ld,%.10g\n", p, x, y, apix[ii]);
+		    else
+			printf("plane %ld, x %ld, y %ld, %*.*f\n", p, x, y,
+			       11, 10, apix[ii]);
+		}
+	    }
+	}
 
-    printf ("The number of differences = %d\n",errorcounter);
+	if (showstats) {
+	    stats_init(&planestats);
+	    for (ii = 0; ii < npixels; ii++) {
+		x = fpixel[0] + ii % nx;
+		y = fpixel[1] + ii / nx;
+		stats_add(&planestats, apix[ii], p, x, y);
+		stats_add(&allstats, apix[ii], p, x, y);
+	    }
+	    memcpy(sorted, apix, npixels * sizeof(double));
+	    snprintf(label, sizeof(label), "plane %ld", p);
+	    stats_print(out, label, &planestats, sorted, npixels);
+	}
+    }
+    if (showstats && !status && range[2][1] > range[2][0])
+	stats_print(out, "all planes", &allstats, NULL, 0);
 
     free(apix);
-
+    free(sorted);
     fits_close_file(afptr, &status);
 
-    if (status) fits_report_error(stderr, status); /* print any error message */
-    return(status);
+    if (status)
+	fits_report_error(stderr, status);	/* print any error message */
+    return (status);
 }
-
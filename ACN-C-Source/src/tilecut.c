@@ -0,0 +1,684 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "fitsio.h"
+#include "catalog.h"
+#include "rangeio.h"
+
+/*
+*      tilecut: Cut star boxes out of full frames on a server, reading only the bytes of
+*               the frame which hold the boxes.
+*
+*                 The frame may be tile compressed (fpack'ed .fz) or a plain image, local or
+*                 served over HTTP (see rangeio.c). The headers are read first. For a tile
+*                 compressed frame the table of tiles is read next, which is small, and its
+*                 descriptors give where in the heap each tile intersecting a star box is
+*                 stored. For a plain image the rows of the boxes are located directly. Those
+*                 byte ranges, merged when they are close, are the only other parts of the
+*                 frame read.
+*
+*                 The bytes read are placed at their offsets in an otherwise empty in memory
+*                 copy of the frame, which CFITSIO opens as usual. It decodes the tiles of
+*                 each box, reading nothing else, so any compression, quantisation and
+*                 dither CFITSIO supports is handled. The boxes are written as plain FITS
+*                 files outdir/starN-name, with .fz dropped from name, the file that funpack
+*                 of the clipped starN-name.fz copy gave before.
+*
+*                 The stars and box widths come from an acn-aphot config, as for cutout.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+#define BUFSIZE 2056
+#define HEADCHUNK (4 * 2880)	// header bytes asked for at a time
+
+// A byte range of the frame
+struct span {
+    long long start, end;	// end is one past the last byte
+};
+
+// The frame being cut, the parts read so far
+struct frame {
+    struct range_source src;
+    char *head;			// the first headlen bytes of the file
+    long long headlen;
+    struct span *spans;
+    long nspans, allocated;
+};
+
+static struct catalog stars;
+static const char *outdir = ".";
+static long onlystar, width;	// 0 for all stars, for the config widths
+static long long gap = 32768;	// ranges closer than this are read as one
+static int quiet;
+
+void bail(const char *msg, ...)
+{
+    va_list arg_ptr;
+
+    va_start(arg_ptr, msg);
+    if (msg) {
+	vfprintf(stderr, msg, arg_ptr);
+    }
+    va_end(arg_ptr);
+    fprintf(stderr, "\nAborting...\n");
+
+    exit(1);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: tilecut [options] config frame...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -o dir      : directory for the cutouts (default .)\n");
+    fprintf(stderr, "  -s star     : cut only this star of the config, 1 is the first\n");
+    fprintf(stderr, "  -w pixels   : width of every box (default the box width of each star)\n");
+    fprintf(stderr, "  -g bytes    : read ranges closer than this as one (default 32768)\n");
+    fprintf(stderr, "  -q          : do not report the bytes read\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  A frame is an http:// URL or a local path, tile compressed or not.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  tilecut -s 1 -o ../Exp ../MasterFiles/config \\\n");
+    fprintf(stderr, "          http://s3-eu-west-1.amazonaws.com/astronomydata/AstronomyData/compressedRAW/bf00001.fits.fz\n");
+    fprintf(stderr, "  tilecut -w 83 config /mnt/storage1/AstronomyData/compressedRAW/bf00001.fits.fz\n\n");
+}
+
+//
+// Make sure the first upto bytes of the file are in f->head, or as much of
+// them as the file has. Returns 0 on success.
+//
+static int need_head(struct frame *f, long long upto, char *errmsg,
+		     size_t errlen)
+{
+    long long want, got;
+    char *head;
+
+    if (upto <= f->headlen || (f->src.size >= 0 && f->headlen >= f->src.size))
+	return 0;
+    want = (upto + HEADCHUNK - 1) / HEADCHUNK * HEADCHUNK;
+    if ((head = (char *) realloc(f->head, want)) == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	return 1;
+    }
+    f->head = head;
+    got = range_read(&f->src, f->headlen, want - f->headlen,
+		     f->head + f->headlen, errmsg, errlen);
+    if (got < 0)
+	return 1;
+    f->headlen += got;
+    return 0;
+}
+
+//
+// Read the header starting at byte start, setting ncards and the start of its
+// data. Returns 0 on success, the cards are then at f->head + start.
+//
+static int read_header(struct frame *f, long long start, long *ncards,
+		       long long *datastart, char *errmsg, size_t errlen)
+{
+    long long at;
+
+    for (at = start;; at += 80) {
+	if (need_head(f, at + 80, errmsg, errlen))
+	    return 1;
+	if (at + 80 > f->headlen) {
+	    snprintf(errmsg, errlen, "%s: header ends before the END card",
+		     f->src.path);
+	    return 1;
+	}
+	if (memcmp(f->head + at, "END     ", 8) == 0)
+	    break;
+    }
+    *ncards = (at - start) / 80;
+    *datastart = (at + 80 + 2879) / 2880 * 2880;
+    return 0;
+}
+
+// The value of key in the ncards cards, as written, NULL when it is missing
+static const char *card_value(const char *cards, long ncards, const char *key,
+			      char *value, size_t len)
+{
+    const char *v;
+    size_t n = strlen(key), k = 0;
+    long c;
+
+    for (c = 0; c < ncards; c++) {
+	v = cards + 80 * c;
+	if (strncmp(v, key, n) == 0 && (n == 8 || v[n] == ' ')
+	    && memcmp(v + 8, "= ", 2) == 0)
+	    break;
+    }
+    if (c == ncards)
+	return NULL;
+    for (v += 10; *v == ' ' || *v == '\''; v++);
+    while (k + 1 < len && v < cards + 80 * (c + 1) && *v != '\'' && *v != '/')
+	value[k++] = *v++;
+    while (k > 0 && value[k - 1] == ' ')
+	k--;
+    value[k] = '\0';
+    return value;
+}
+
+static long long card_int(const char *cards, long ncards, const char *key,
+			  long long def)
+{
+    char value[80];
+
+    return card_value(cards, ncards, key, value, sizeof(value)) != NULL
+	? atoll(value) : def;
+}
+
+static int add_span(struct frame *f, long long start, long long end)
+{
+    struct span *spans;
+
+    if (end <= start)
+	return 0;
+    if (f->nspans == f->allocated) {
+	f->allocated = f->allocated ? 2 * f->allocated : 256;
+	spans = (struct span *) realloc(f->spans,
+					f->allocated * sizeof(struct span));
+	if (spans == NULL)
+	    return 1;
+	f->spans = spans;
+    }
+    f->spans[f->nspans].start = start;
+    f->spans[f->nspans++].end = end;
+    return 0;
+}
+
+static int compare_spans(const void *a, const void *b)
+{
+    const struct span *x = a, *y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Sort the spans and merge those less than gap apart
+static void merge_spans(struct frame *f)
+{
+    long i, n = 0;
+
+    if (f->nspans == 0)
+	return;
+    qsort(f->spans, f->nspans, sizeof(struct span), compare_spans);
+    for (i = 1; i < f->nspans; i++) {
+	if (f->spans[i].start <= f->spans[n].end + gap) {
+	    if (f->spans[i].end > f->spans[n].end)
+		f->spans[n].end = f->spans[i].end;
+	} else
+	    f->spans[++n] = f->spans[i];
+    }
+    f->nspans = n + 1;
+}
+
+// Bytes per element of a binary table TFORM type letter, 0 for bits
+static int type_bytes(char type)
+{
+    switch (type) {
+    case 'L':
+    case 'B':
+    case 'A':
+	return 1;
+    case 'I':
+	return 2;
+    case 'J':
+    case 'E':
+	return 4;
+    case 'K':
+    case 'D':
+    case 'C':
+    case 'P':
+	return 8;
+    case 'M':
+    case 'Q':
+	return 16;
+    default:
+	return 0;
+    }
+}
+
+static long long big_endian(const unsigned char *p, int n)
+{
+    long long v = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+	v = (v << 8) | p[i];
+    return v;
+}
+
+// The star boxes, clipped to an image of naxes[0] by naxes[1]
+static void star_boxes(const long *naxes, long *x0, long *x1, long *y0,
+		       long *y1)
+{
+    long s, w;
+
+    for (s = 0; s < stars.nstars; s++) {
+	w = width > 0 ? width : (long) stars.box[s];
+	x0[s] = (long) stars.x[s] - w / 2;
+	y0[s] = (long) stars.y[s] - w / 2;
+	x1[s] = x0[s] + w - 1;
+	y1[s] = y0[s] + w - 1;
+	x0[s] = x0[s] < 1 ? 1 : x0[s];
+	y0[s] = y0[s] < 1 ? 1 : y0[s];
+	x1[s] = x1[s] > naxes[0] ? naxes[0] : x1[s];
+	y1[s] = y1[s] > naxes[1] ? naxes[1] : y1[s];
+    }
+}
+
+static int wanted(long s)
+{
+    return onlystar == 0 || onlystar == s + 1;
+}
+
+//
+// The byte ranges of the tiles of a tile compressed image which intersect
+// the boxes. The header cards describe the binary table of tiles starting at
+// datastart, which is read here.
+//
+static int tile_spans(struct frame *f, const char *cards, long ncards,
+		      long long datastart, const long *naxes, const long *x0,
+		      const long *x1, const long *y0, const long *y1,
+		      char *errmsg, size_t errlen)
+{
+    char key[16], form[80];
+    long long rowbytes, nrows, theap, row, nelem, offset;
+    long tile[3], ntiles[3], tx, ty, tz, s, c, tfields;
+    long colstart[999], coldesc[999], elembytes[999], ncols = 0, at = 0;
+    const unsigned char *desc;
+    char *p;
+    int i;
+
+    rowbytes = card_int(cards, ncards, "NAXIS1", 0);
+    nrows = card_int(cards, ncards, "NAXIS2", 0);
+    theap = card_int(cards, ncards, "THEAP", rowbytes * nrows);
+    tfields = card_int(cards, ncards, "TFIELDS", 0);
+    for (i = 0; i < 3; i++) {
+	snprintf(key, sizeof(key), "ZTILE%d", i + 1);
+	tile[i] = card_int(cards, ncards, key, i == 0 ? naxes[0] : 1);
+	tile[i] = tile[i] < 1 ? 1 : tile[i];
+	ntiles[i] = (naxes[i] + tile[i] - 1) / tile[i];
+    }
+    if (rowbytes <= 0 || nrows != ntiles[0] * ntiles[1] * ntiles[2]
+	|| tfields <= 0 || tfields > 999) {
+	snprintf(errmsg, errlen, "%s: not a tile compressed image table",
+		 f->src.path);
+	return 1;
+    }
+
+    // where the variable length columns, which hold the tiles, are in a row
+    for (c = 1; c <= tfields; c++) {
+	long repeat;
+
+	snprintf(key, sizeof(key), "TFORM%ld", c);
+	if (card_value(cards, ncards, key, form, sizeof(form)) == NULL) {
+	    snprintf(errmsg, errlen, "%s: %s is missing", f->src.path, key);
+	    return 1;
+	}
+	repeat = strtol(form, &p, 10);
+	if (p == form)
+	    repeat = 1;
+	if (*p == 'P' || *p == 'Q') {
+	    colstart[ncols] = at;
+	    coldesc[ncols] = *p == 'P' ? 4 : 8;
+	    elembytes[ncols++] = type_bytes(p[1]) ? type_bytes(p[1]) : 1;
+	}
+	at += *p == 'X' ? (repeat + 7) / 8 : repeat * type_bytes(*p);
+    }
+    if (at != rowbytes || ncols == 0) {
+	snprintf(errmsg, errlen, "%s: the tile table columns do not add up",
+		 f->src.path);
+	return 1;
+    }
+
+    // the table itself, it is small, one row per tile
+    if (need_head(f, datastart + rowbytes * nrows, errmsg, errlen))
+	return 1;
+    if (f->headlen < datastart + rowbytes * nrows) {
+	snprintf(errmsg, errlen, "%s: truncated in the tile table", f->src.path);
+	return 1;
+    }
+
+    for (s = 0; s < stars.nstars; s++) {
+	if (!wanted(s))
+	    continue;
+	for (tz = 0; tz < ntiles[2]; tz++)
+	    for (ty = (y0[s] - 1) / tile[1]; ty <= (y1[s] - 1) / tile[1]; ty++)
+		for (tx = (x0[s] - 1) / tile[0]; tx <= (x1[s] - 1) / tile[0];
+		     tx++) {
+		    row = tx + ntiles[0] * (ty + ntiles[1] * tz);
+		    for (c = 0; c < ncols; c++) {
+			desc = (const unsigned char *) f->head + datastart
+			    + row * rowbytes + colstart[c];
+			nelem = big_endian(desc, coldesc[c]);
+			offset = big_endian(desc + coldesc[c], coldesc[c]);
+			if (add_span(f, datastart + theap + offset,
+				     datastart + theap + offset
+				     + nelem * elembytes[c])) {
+			    snprintf(errmsg, errlen, "Memory allocation error");
+			    return 1;
+			}
+		    }
+		}
+    }
+    return 0;
+}
+
+// The byte ranges of the box rows of a plain image whose data starts at datastart
+static int image_spans(struct frame *f, long long datastart, int bitpix,
+		       const long *naxes, const long *x0, const long *x1,
+		       const long *y0, const long *y1, char *errmsg,
+		       size_t errlen)
+{
+    long long bytes = (bitpix < 0 ? -bitpix : bitpix) / 8, at;
+    long s, y, p;
+
+    for (s = 0; s < stars.nstars; s++) {
+	if (!wanted(s))
+	    continue;
+	for (p = 0; p < naxes[2]; p++)
+	    for (y = y0[s]; y <= y1[s]; y++) {
+		at = datastart + bytes * (((long long) p * naxes[1] + y - 1)
+					  * naxes[0] + x0[s] - 1);
+		if (add_span(f, at, at + bytes * (x1[s] - x0[s] + 1))) {
+		    snprintf(errmsg, errlen, "Memory allocation error");
+		    return 1;
+		}
+	    }
+    }
+    return 0;
+}
+
+// Keywords of a tile compressed HDU that describe the table, not the image
+static int table_key(const char *card)
+{
+    static const char *keys[] = { "XTENSION", "TFIELDS", "THEAP", "TTYPE",
+	"TFORM", "TUNIT", "TDIM", "TNULL", "TSCAL", "TZERO", "ZIMAGE"
+    };
+    size_t k;
+
+    for (k = 0; k < sizeof(keys) / sizeof(keys[0]); k++)
+	if (strncmp(card, keys[k], strlen(keys[k])) == 0)
+	    return 1;
+    return strncmp(card, "EXTNAME = 'COMPRESSED_IMAGE'", 28) == 0;
+}
+
+//
+// Write box s of the frame open in in to outdir/starN-name
+//
+static int write_box(fitsfile * in, const char *name, long s, int naxis,
+		     const long *naxes, long x0, long x1, long y0, long y1,
+		     double *pix, char *errmsg, size_t errlen)
+{
+    fitsfile *out = NULL;
+    char outpath[BUFSIZE], card[FLEN_CARD], fitserr[FLEN_ERRMSG];
+    long fpixel[3], lpixel[3], inc[3] = { 1, 1, 1 }, onaxes[3],
+	opixel[3] = { 1, 1, 1 }, p;
+    int status = 0, imgtype, nkeys, k, class;
+    double v;
+
+    snprintf(outpath, sizeof(outpath), "!%s/star%ld-%s", outdir, s + 1, name);
+    fits_get_img_equivtype(in, &imgtype, &status);
+    fits_create_file(&out, outpath, &status);
+    onaxes[0] = x1 - x0 + 1;
+    onaxes[1] = y1 - y0 + 1;
+    onaxes[2] = naxes[2];
+    fits_create_img(out, imgtype, naxis, onaxes, &status);
+
+    fits_get_hdrspace(in, &nkeys, NULL, &status);
+    for (k = 1; k <= nkeys && !status; k++) {
+	fits_read_record(in, k, card, &status);
+	class = fits_get_keyclass(card);
+	if (class == TYP_STRUC_KEY || class == TYP_CMPRS_KEY
+	    || class == TYP_SCAL_KEY || class == TYP_CKSUM_KEY
+	    || table_key(card))
+	    continue;
+	fits_write_record(out, card, &status);
+    }
+    if (!status && fits_read_key(in, TDOUBLE, "CRPIX1", &v, NULL, &status) == 0) {
+	v -= x0 - 1;
+	fits_update_key(out, TDOUBLE, "CRPIX1", &v, NULL, &status);
+    }
+    if (status == KEY_NO_EXIST)
+	status = 0;
+    if (!status && fits_read_key(in, TDOUBLE, "CRPIX2", &v, NULL, &status) == 0) {
+	v -= y0 - 1;
+	fits_update_key(out, TDOUBLE, "CRPIX2", &v, NULL, &status);
+    }
+    if (status == KEY_NO_EXIST)
+	status = 0;
+    v = 1 - x0;
+    fits_update_key(out, TDOUBLE, "LTV1", &v,
+		    "offset of the cutout in the original", &status);
+    v = 1 - y0;
+    fits_update_key(out, TDOUBLE, "LTV2", &v,
+		    "offset of the cutout in the original", &status);
+    snprintf(card, sizeof(card), "tilecut [%ld:%ld,%ld:%ld] of %s", x0, x1,
+	     y0, y1, name);
+    fits_write_history(out, card, &status);
+
+    for (p = 1; p <= naxes[2] && !status; p++) {
+	fpixel[0] = x0;
+	fpixel[1] = y0;
+	lpixel[0] = x1;
+	lpixel[1] = y1;
+	fpixel[2] = lpixel[2] = opixel[2] = p;
+	fits_read_subset(in, TDOUBLE, fpixel, lpixel, inc, NULL, pix, NULL,
+			 &status);
+	fits_write_pix(out, TDOUBLE, opixel, onaxes[0] * onaxes[1], pix,
+		       &status);
+    }
+
+    k = 0;
+    if (out != NULL)
+	fits_close_file(out, status ? &k : &status);
+    if (status) {
+	fits_get_errstatus(status, fitserr);
+	snprintf(errmsg, errlen, "%s: %s", outpath + 1, fitserr);
+    }
+    return status;
+}
+
+//
+// Cut the wanted stars out of the frame at location. Returns 0 on success,
+// otherwise non zero with the reason in errmsg.
+//
+static int cut_frame(const char *location, char *errmsg, size_t errlen)
+{
+    struct frame f;
+    fitsfile *in = NULL;
+    char name[BUFSIZE], value[80];
+    const char *cards, *base;
+    long ncards, naxes[3] = { 1, 1, 1 }, *x0 = NULL, *x1, *y0, *y1, s, i;
+    long long datastart, hdrstart = 0, got, fetched;
+    int status = 0, zimage = 0, hdu = 1, naxis, bitpix, rc = 1, k;
+    size_t size;
+    void *mem = NULL;
+    double *pix = NULL;
+
+    memset(&f, 0, sizeof(f));
+    base = strrchr(location, '/') ? strrchr(location, '/') + 1 : location;
+    snprintf(name, sizeof(name), "%s", base);
+    if (strlen(name) > 3 && strcmp(name + strlen(name) - 3, ".fz") == 0)
+	name[strlen(name) - 3] = '\0';
+
+    if (range_open(&f.src, location, errmsg, errlen))
+	return 1;
+    if (read_header(&f, 0, &ncards, &datastart, errmsg, errlen))
+	goto done;
+    if (memcmp(f.head, "SIMPLE  =", 9) != 0) {
+	snprintf(errmsg, errlen, "%s: not a FITS file", location);
+	goto done;
+    }
+    cards = f.head;
+    if (card_int(cards, ncards, "NAXIS", 0) == 0
+	&& card_value(cards, ncards, "EXTEND", value, sizeof(value)) != NULL
+	&& value[0] == 'T') {
+	// the image is in the first extension, as fpack writes it
+	hdrstart = datastart;
+	hdu = 2;
+	if (read_header(&f, hdrstart, &ncards, &datastart, errmsg, errlen))
+	    goto done;
+	cards = f.head + hdrstart;
+	zimage = card_value(cards, ncards, "ZIMAGE", value, sizeof(value))
+	    != NULL && value[0] == 'T';
+    }
+
+    naxis = card_int(cards, ncards, zimage ? "ZNAXIS" : "NAXIS", 0);
+    bitpix = card_int(cards, ncards, zimage ? "ZBITPIX" : "BITPIX", 0);
+    for (i = 0; i < naxis && i < 3; i++) {
+	snprintf(value, sizeof(value), "%sNAXIS%ld", zimage ? "Z" : "", i + 1);
+	naxes[i] = card_int(cards, ncards, value, 0);
+    }
+    if (naxis < 2 || naxis > 3 || naxes[0] <= 0 || naxes[1] <= 0
+	|| naxes[2] <= 0) {
+	snprintf(errmsg, errlen, "%s: only 2 and 3 dimensional images are cut",
+		 location);
+	goto done;
+    }
+
+    x0 = (long *) malloc(4 * stars.nstars * sizeof(long));
+    if (x0 == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	goto done;
+    }
+    x1 = x0 + stars.nstars;
+    y0 = x1 + stars.nstars;
+    y1 = y0 + stars.nstars;
+    star_boxes(naxes, x0, x1, y0, y1);
+    for (s = 0; s < stars.nstars; s++)
+	if (wanted(s) && (x1[s] < x0[s] || y1[s] < y0[s])) {
+	    snprintf(errmsg, errlen, "%s: star %ld at %g %g is off the image",
+		     location, s + 1, stars.x[s], stars.y[s]);
+	    goto done;
+	}
+
+    if (zimage ? tile_spans(&f, cards, ncards, datastart, naxes, x0, x1, y0,
+			    y1, errmsg, errlen)
+	: image_spans(&f, datastart, bitpix, naxes, x0, x1, y0, y1, errmsg,
+		      errlen))
+	goto done;
+    merge_spans(&f);
+
+    if (f.src.size < 0) {
+	snprintf(errmsg, errlen, "%s: the server did not give the file size",
+		 location);
+	goto done;
+    }
+    // an empty copy of the frame, only the parts read are ever touched
+    size = f.src.size;
+    if ((mem = calloc(1, size)) == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	goto done;
+    }
+    memcpy(mem, f.head, f.headlen < (long long) size ? (size_t) f.headlen : size);
+    for (i = 0; i < f.nspans; i++) {
+	if (f.spans[i].end > (long long) size) {
+	    snprintf(errmsg, errlen, "%s: truncated, tiles past the end",
+		     location);
+	    goto done;
+	}
+	if (f.spans[i].end <= f.headlen)
+	    continue;		// already read with the headers
+	if (f.spans[i].start < f.headlen)
+	    f.spans[i].start = f.headlen;
+	got = range_read(&f.src, f.spans[i].start,
+			 f.spans[i].end - f.spans[i].start,
+			 (char *) mem + f.spans[i].start, errmsg, errlen);
+	if (got < 0)
+	    goto done;
+	if (got != f.spans[i].end - f.spans[i].start) {
+	    snprintf(errmsg, errlen, "%s: truncated", location);
+	    goto done;
+	}
+    }
+    fetched = f.src.transferred;
+    range_free(&f.src);
+
+    fits_open_memfile(&in, name, READONLY, &mem, &size, 0, NULL, &status);
+    fits_movabs_hdu(in, hdu, NULL, &status);
+    if (status) {
+	fits_get_errstatus(status, value);
+	snprintf(errmsg, errlen, "%s: %s", location, value);
+	goto done;
+    }
+    pix = (double *) malloc(naxes[0] * naxes[1] * sizeof(double));
+    if (pix == NULL) {
+	snprintf(errmsg, errlen, "Memory allocation error");
+	goto done;
+    }
+    for (s = 0; s < stars.nstars; s++)
+	if (wanted(s) && write_box(in, name, s, naxis, naxes, x0[s], x1[s],
+				   y0[s], y1[s], pix, errmsg, errlen))
+	    goto done;
+
+    if (!quiet)
+	printf("%s: read %lld of %lld bytes (%.1f%%) in %ld requests\n",
+	       location, fetched, (long long) size,
+	       size > 0 ? 100.0 * fetched / size : 0, f.src.requests);
+    rc = 0;
+
+  done:
+    k = 0;
+    if (in != NULL)
+	fits_close_file(in, &k);
+    range_free(&f.src);
+    free(mem);
+    free(pix);
+    free(x0);
+    free(f.head);
+    free(f.spans);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    char errmsg[BUFSIZE];
+    int c, failed = 0, i;
+
+    while ((c = getopt(argc, argv, "o:s:w:g:qh")) != -1) {
+	switch (c) {
+	case 'o':
+	    outdir = optarg;
+	    break;
+	case 's':
+	    onlystar = atol(optarg);
+	    break;
+	case 'w':
+	    width = atol(optarg);
+	    break;
+	case 'g':
+	    gap = atoll(optarg);
+	    break;
+	case 'q':
+	    quiet = 1;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (argc - optind < 2) {
+	usage();
+	return 1;
+    }
+
+    catalog_init(&stars);
+    catalog_read(&stars, argv[optind]);
+    if (stars.nstars == 0)
+	bail("No stars in %s\n", argv[optind]);
+    if (onlystar < 0 || onlystar > stars.nstars)
+	bail("There is no star %ld in %s\n", onlystar, argv[optind]);
+
+    for (i = optind + 1; i < argc; i++)
+	if (cut_frame(argv[i], errmsg, sizeof(errmsg))) {
+	    fprintf(stderr, "Error: %s\n", errmsg);
+	    failed++;
+	}
+    catalog_free(&stars);
+    return failed > 0;
+}
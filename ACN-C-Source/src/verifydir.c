@@ -0,0 +1,514 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "fitsio.h"
+#include "fitsdiff.h"
+
+/*
+*      verifydir: Compare every output in one directory with the file of the same name in
+*                 another, e.g. the results of a run before and after a pipeline change.
+*
+*                 FITS images and cubes (.fits .fit .fts .fz) are compared pixel by pixel as
+*                 compare does. Text results (.result .diff) are compared line by line, numeric
+*                 fields within the tolerances and other fields exactly. Files are compared
+*                 concurrently, one per thread, and a line per file is printed in name order
+*                 followed by the totals over the whole directory.
+*
+*                 CFITSIO must be built with --enable-reentrant for more than one thread, a
+*                 library built without it is used from a single thread.
+*
+*                 The exit status is 0 when everything matches, 1 when a file differs or is
+*                 missing from one directory and 2 when a file could not be compared.
+*
+*        Paul Doyle 2012, Dublin Institute of Technology
+*/
+
+enum { KIND_FITS, KIND_TEXT };
+enum { PAIR_MATCH, PAIR_DIFFER, PAIR_ERROR, PAIR_ONLY1, PAIR_ONLY2 };
+
+struct pair {
+    char *name;
+    int kind;
+    int status;
+    long long checked, differ, nanmismatch;
+    long long textdiffer;	// non numeric fields or line counts which differ
+    double maxabs, maxrel, sumsq;
+    long long maxindex;		// pixel or numeric field of maxabs
+    long naxes[3];
+    long firstline;		// text: first line which differs
+    double seconds;
+    int done;			// compared or present in only one directory
+    char errmsg[FLEN_ERRMSG + FLEN_FILENAME];
+};
+
+static const char *dir1, *dir2;
+static struct diff_options opt = { -1, -1, -1, 1, 0, NULL };
+static struct pair *pairs;
+static long npairs;
+static long nextpair, nextprint;	// protected by lock
+static int quiet;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: verifydir [options] dir1 dir2\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -a abs     : absolute tolerance |a - b|\n");
+    fprintf(stderr, "  -r rel     : relative tolerance |a - b| / max(|a|, |b|)\n");
+    fprintf(stderr, "  -u ulp     : tolerance in units in the last place of a double\n");
+    fprintf(stderr, "  -j threads : files compared at once (default one per core)\n");
+    fprintf(stderr, "  -b pixels  : pixels read at a time (default %ld)\n", DIFF_BLOCK);
+    fprintf(stderr, "  -q         : only list the files which do not match\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  With no tolerance values within 0.001 match, with several a value\n");
+    fprintf(stderr, "  matches when it is within any of them.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples: \n");
+    fprintf(stderr, "  verifydir before/ after/                   compare the 2 runs\n");
+    fprintf(stderr, "  verifydir -u 4 -j 8 -q before/ after/\n\n");
+}
+
+void bail(const char *msg)
+{
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(2);
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int has_suffix(const char *name, const char *suffix)
+{
+    size_t n = strlen(name), s = strlen(suffix);
+
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+// The kind of comparison for a file name, -1 when it is not an output
+static int file_kind(const char *name)
+{
+    if (has_suffix(name, ".fits") || has_suffix(name, ".fit")
+	|| has_suffix(name, ".fts") || has_suffix(name, ".fz"))
+	return KIND_FITS;
+    if (has_suffix(name, ".result") || has_suffix(name, ".diff"))
+	return KIND_TEXT;
+    return -1;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+//
+// The outputs in dir sorted by name, returns the number found
+//
+static long list_outputs(const char *dir, char ***names)
+{
+    DIR *d;
+    struct dirent *e;
+    struct stat sb;
+    char path[FLEN_FILENAME];
+    long n = 0, allocated = 0;
+
+    if ((d = opendir(dir)) == NULL) {
+	fprintf(stderr, "Error: cannot open directory %s\n", dir);
+	exit(2);
+    }
+    *names = NULL;
+    while ((e = readdir(d)) != NULL) {
+	if (file_kind(e->d_name) < 0)
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+	if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode))
+	    continue;
+	if (n == allocated) {
+	    allocated = allocated ? 2 * allocated : 256;
+	    *names = (char **) realloc(*names, allocated * sizeof(char *));
+	    if (*names == NULL)
+		bail("Memory allocation error");
+	}
+	if (((*names)[n++] = strdup(e->d_name)) == NULL)
+	    bail("Memory allocation error");
+    }
+    closedir(d);
+    if (n > 0)
+	qsort(*names, n, sizeof(char *), compare_names);
+    return n;
+}
+
+//
+// Merge the two sorted listings into pairs, a name in only one directory
+// is reported as missing from the other
+//
+static void make_pairs(char **names1, long n1, char **names2, long n2)
+{
+    long i = 0, j = 0;
+    int c;
+
+    pairs = (struct pair *) calloc(n1 + n2 + 1, sizeof(struct pair));
+    if (pairs == NULL)
+	bail("Memory allocation error");
+    while (i < n1 || j < n2) {
+	struct pair *p = &pairs[npairs++];
+
+	c = i == n1 ? 1 : j == n2 ? -1 : strcmp(names1[i], names2[j]);
+	if (c < 0) {
+	    p->name = names1[i++];
+	    p->status = PAIR_ONLY1;
+	    p->done = 1;
+	} else if (c > 0) {
+	    p->name = names2[j++];
+	    p->status = PAIR_ONLY2;
+	    p->done = 1;
+	} else {
+	    p->name = names1[i++];
+	    free(names2[j++]);
+	    p->status = PAIR_MATCH;
+	}
+	p->kind = file_kind(p->name);
+	p->maxindex = -1;
+    }
+}
+
+static void copy_stats(struct pair *p, const struct diff_stats *st)
+{
+    p->checked = st->checked;
+    p->differ = st->differ;
+    p->nanmismatch = st->nanmismatch;
+    p->maxabs = st->maxabs;
+    p->maxrel = st->maxrel;
+    p->sumsq = st->sumsq;
+    p->maxindex = st->maxindex;
+    p->naxes[0] = st->naxes[0];
+    p->naxes[1] = st->naxes[1];
+    p->naxes[2] = st->naxes[2];
+}
+
+// A whole field which strtod accepts as a number
+static int numeric_field(const char *s, double *v)
+{
+    char *end;
+
+    *v = strtod(s, &end);
+    return end != s && *end == '\0';
+}
+
+//
+// Compare two text results field by field. The numeric fields of each line
+// go through diff_block so the statistics mean the same as for images, with
+// the index counting numeric fields from the start of the file.
+//
+static int compare_text(const char *afile, const char *bfile, struct pair *p,
+			struct diff_stats *st)
+{
+    FILE *af, *bf;
+    char *aline = NULL, *bline = NULL, *as, *bs, *atok, *btok;
+    size_t alen = 0, blen = 0;
+    ssize_t ar, br;
+    double *a = NULL, *b = NULL;
+    long nfields = 0, allocated = 0, line = 0, n;
+    long long before;
+    int textdiffer;
+
+    diff_init(st);
+    if ((af = fopen(afile, "r")) == NULL) {
+	snprintf(p->errmsg, sizeof(p->errmsg), "cannot open %s", afile);
+	return 1;
+    }
+    if ((bf = fopen(bfile, "r")) == NULL) {
+	snprintf(p->errmsg, sizeof(p->errmsg), "cannot open %s", bfile);
+	fclose(af);
+	return 1;
+    }
+
+    for (;;) {
+	ar = getline(&aline, &alen, af);
+	br = getline(&bline, &blen, bf);
+	if (ar < 0 && br < 0)
+	    break;
+	line++;
+	if (ar < 0 || br < 0) {
+	    // one file is longer, count its remaining lines as differing
+	    FILE *rest = ar < 0 ? bf : af;
+	    char **rline = ar < 0 ? &bline : &aline;
+	    size_t *rlen = ar < 0 ? &blen : &alen;
+
+	    if (p->firstline == 0)
+		p->firstline = line;
+	    p->textdiffer++;
+	    while (getline(rline, rlen, rest) >= 0)
+		p->textdiffer++;
+	    break;
+	}
+
+	textdiffer = 0;
+	n = 0;
+	atok = strtok_r(aline, " \t\r\n", &as);
+	btok = strtok_r(bline, " \t\r\n", &bs);
+	while (atok != NULL && btok != NULL) {
+	    double av, bv;
+
+	    if (numeric_field(atok, &av) && numeric_field(btok, &bv)) {
+		if (n == allocated) {
+		    allocated = allocated ? 2 * allocated : 64;
+		    a = (double *) realloc(a, allocated * sizeof(double));
+		    b = (double *) realloc(b, allocated * sizeof(double));
+		    if (a == NULL || b == NULL)
+			bail("Memory allocation error");
+		}
+		a[n] = av;
+		b[n++] = bv;
+	    } else if (strcmp(atok, btok) != 0)
+		textdiffer = 1;
+	    atok = strtok_r(NULL, " \t\r\n", &as);
+	    btok = strtok_r(NULL, " \t\r\n", &bs);
+	}
+	if (atok != NULL || btok != NULL)
+	    textdiffer = 1;	// different number of fields
+
+	before = st->differ;
+	if (n > 0)
+	    diff_block(a, b, n, nfields, &opt, st, NULL);
+	nfields += n;
+	if (textdiffer)
+	    p->textdiffer++;
+	if ((textdiffer || st->differ > before) && p->firstline == 0)
+	    p->firstline = line;
+    }
+
+    free(aline);
+    free(bline);
+    free(a);
+    free(b);
+    fclose(af);
+    fclose(bf);
+    copy_stats(p, st);
+    return 0;
+}
+
+static void compare_pair(struct pair *p, struct diff_stats *st)
+{
+    char afile[FLEN_FILENAME], bfile[FLEN_FILENAME];
+    double start = now();
+    int err;
+
+    snprintf(afile, sizeof(afile), "%s/%s", dir1, p->name);
+    snprintf(bfile, sizeof(bfile), "%s/%s", dir2, p->name);
+    if (p->kind == KIND_FITS) {
+	err = fitsdiff_files(afile, bfile, &opt, st, p->errmsg,
+			     sizeof(p->errmsg));
+	if (!err)
+	    copy_stats(p, st);
+    } else
+	err = compare_text(afile, bfile, p, st);
+
+    if (err)
+	p->status = PAIR_ERROR;
+    else if (p->differ > 0 || p->textdiffer > 0)
+	p->status = PAIR_DIFFER;
+    p->seconds = now() - start;
+}
+
+static void print_pair(const struct pair *p)
+{
+    if (quiet && p->status == PAIR_MATCH)
+	return;
+    switch (p->status) {
+    case PAIR_ONLY1:
+	printf("MISSING %s: only in %s\n", p->name, dir1);
+	return;
+    case PAIR_ONLY2:
+	printf("MISSING %s: only in %s\n", p->name, dir2);
+	return;
+    case PAIR_ERROR:
+	printf("ERROR   %s: %s\n", p->name, p->errmsg);
+	return;
+    }
+
+    printf("%-7s %s: %lld checked, %lld differ", p->status == PAIR_MATCH
+	   ? "OK" : "DIFFER", p->name, p->checked, p->differ);
+    if (p->nanmismatch > 0)
+	printf(" (%lld NaN)", p->nanmismatch);
+    if (p->checked > 0)
+	printf(", max abs %g, rms %g", p->maxabs,
+	       sqrt(p->sumsq / p->checked));
+    if (p->kind == KIND_FITS && p->maxindex >= 0)
+	printf(" at plane %lld, r %lld, c %lld",
+	       p->maxindex / ((long long) p->naxes[0] * p->naxes[1]) + 1,
+	       p->maxindex / p->naxes[0] % p->naxes[1] + 1,
+	       p->maxindex % p->naxes[0] + 1);
+    if (p->textdiffer > 0)
+	printf(", %lld other lines differ", p->textdiffer);
+    if (p->kind == KIND_TEXT && p->firstline > 0)
+	printf(", first at line %ld", p->firstline);
+    printf(" (%.2fs)\n", p->seconds);
+}
+
+//
+// Worker: take the next pair still to compare until none are left. Lines are
+// printed in name order as soon as every earlier pair is done.
+//
+static void *worker(void *arg)
+{
+    struct diff_stats *st;
+    long i;
+
+    (void) arg;
+    if ((st = (struct diff_stats *) malloc(sizeof(*st))) == NULL)
+	bail("Memory allocation error");
+    for (;;) {
+	pthread_mutex_lock(&lock);
+	while (nextpair < npairs && pairs[nextpair].done)
+	    nextpair++;		// present in only one directory
+	i = nextpair < npairs ? nextpair++ : -1;
+	pthread_mutex_unlock(&lock);
+	if (i < 0)
+	    break;
+
+	compare_pair(&pairs[i], st);
+
+	pthread_mutex_lock(&lock);
+	pairs[i].done = 1;
+	while (nextprint < npairs && pairs[nextprint].done)
+	    print_pair(&pairs[nextprint++]);
+	fflush(stdout);
+	pthread_mutex_unlock(&lock);
+    }
+    free(st);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    char **names1, **names2;
+    long n1, n2, i, count[PAIR_ONLY2 + 1] = { 0 };
+    long long checked = 0, differ = 0, nanmismatch = 0, textdiffer = 0;
+    double sumsq = 0, maxabs = 0, maxrel = 0, start;
+    const char *maxfile = NULL;
+    pthread_t *threads;
+    int nthreads = 0, c, t;
+
+    while ((c = getopt(argc, argv, "a:r:u:j:b:qh")) != -1) {
+	switch (c) {
+	case 'a':
+	    opt.abs = atof(optarg);
+	    break;
+	case 'r':
+	    opt.rel = atof(optarg);
+	    break;
+	case 'u':
+	    opt.ulp = atoll(optarg);
+	    break;
+	case 'j':
+	    nthreads = atoi(optarg);
+	    break;
+	case 'b':
+	    opt.block = atol(optarg);
+	    break;
+	case 'q':
+	    quiet = 1;
+	    break;
+	default:
+	    usage();
+	    return 2;
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	return 2;
+    }
+    dir1 = argv[optind];
+    dir2 = argv[optind + 1];
+    if (opt.abs < 0 && opt.rel < 0 && opt.ulp < 0)
+	opt.abs = 0.001;
+
+    if (nthreads <= 0)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+	nthreads = 1;
+    if (nthreads > 1 && !fits_is_reentrant()) {
+	fprintf(stderr, "CFITSIO is not reentrant, comparing one file at a time\n");
+	nthreads = 1;
+    }
+
+    n1 = list_outputs(dir1, &names1);
+    n2 = list_outputs(dir2, &names2);
+    make_pairs(names1, n1, names2, n2);
+    free(names1);
+    free(names2);
+    if (npairs == 0) {
+	fprintf(stderr, "Error: no FITS or result files in %s or %s\n", dir1,
+		dir2);
+	return 2;
+    }
+
+    start = now();
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    if (threads == NULL)
+	bail("Memory allocation error");
+    for (t = 0; t < nthreads; t++)
+	if (pthread_create(&threads[t], NULL, worker, NULL) != 0)
+	    bail("cannot start a thread");
+    for (t = 0; t < nthreads; t++)
+	pthread_join(threads[t], NULL);
+    free(threads);
+    // with only unpaired names no worker had anything to print
+    while (nextprint < npairs)
+	print_pair(&pairs[nextprint++]);
+
+    for (i = 0; i < npairs; i++) {
+	struct pair *p = &pairs[i];
+
+	count[p->status]++;
+	if (p->status != PAIR_MATCH && p->status != PAIR_DIFFER)
+	    continue;
+	checked += p->checked;
+	differ += p->differ;
+	nanmismatch += p->nanmismatch;
+	textdiffer += p->textdiffer;
+	sumsq += p->sumsq;
+	if (p->maxindex >= 0 && (maxfile == NULL || p->maxabs > maxabs)) {
+	    maxabs = p->maxabs;
+	    maxfile = p->name;
+	}
+	if (p->maxrel > maxrel)
+	    maxrel = p->maxrel;
+    }
+
+    printf("\n");
+    printf("Files compared %ld - matching %ld, differing %ld, errors %ld\n",
+	   count[PAIR_MATCH] + count[PAIR_DIFFER] + count[PAIR_ERROR],
+	   count[PAIR_MATCH], count[PAIR_DIFFER], count[PAIR_ERROR]);
+    if (count[PAIR_ONLY1] || count[PAIR_ONLY2])
+	printf("Only in %s %ld, only in %s %ld\n", dir1, count[PAIR_ONLY1],
+	       dir2, count[PAIR_ONLY2]);
+    printf("Values checked %lld - differences = %lld (%lld NaN mismatches)\n",
+	   checked, differ, nanmismatch);
+    if (textdiffer > 0)
+	printf("Other text lines differing %lld\n", textdiffer);
+    if (maxfile != NULL)
+	printf("Max abs diff %g in %s\n", maxabs, maxfile);
+    if (checked > 0)
+	printf("RMS diff %g, max rel diff %g\n", sqrt(sumsq / checked),
+	       maxrel);
+    printf("Elapsed %.2f seconds on %d threads\n", now() - start, nthreads);
+
+    for (i = 0; i < npairs; i++)
+	free(pairs[i].name);
+    free(pairs);
+    if (count[PAIR_ERROR] > 0)
+	return 2;
+    return count[PAIR_DIFFER] + count[PAIR_ONLY1] + count[PAIR_ONLY2] > 0;
+}